@@ -30,7 +30,12 @@
 #include "counter.h"
 #include "constants.h"
 #include "config.h"
+#include "indsupport.h"
+#include "preprocess.h"
+#include "resultcache.h"
 #include <iostream>
+#include <sstream>
+#include <cassert>
 
 using std::cout;
 using std::endl;
@@ -39,6 +44,11 @@ namespace ApproxMC {
     struct AppMCPrivateData {
         Counter counter;
         Config conf;
+
+        //Set once the formula was replaced by its preprocessed version
+        bool preprocessed = false;
+        InputFormula orig_input;
+        vector<char> removed; //by preprocessing, indexed by variable
     };
 }
 
@@ -59,15 +69,71 @@ DLL_PUBLIC AppMC::~AppMC()
     delete data;
 }
 
+static vector<uint32_t> find_ind_support(AppMCPrivateData* data)
+{
+    const InputFormula& in = data->counter.input;
+    const string& cache_dir = data->conf.ind_support_cache;
+    vector<uint32_t> ind;
+    if (!cache_dir.empty() && IndSupport::read_cache(cache_dir, in, ind)) {
+        if (data->conf.verb) {
+            cout << "c [appmc] Independent support of size " << ind.size()
+            << " read from the cache" << endl;
+        }
+        return ind;
+    }
+
+    IndSupport finder(in, data->conf.verb);
+    ind = finder.find(data->conf.ind_support_confl);
+    if (!cache_dir.empty()) {
+        IndSupport::write_cache(cache_dir, in, ind);
+    }
+    return ind;
+}
+
+//The formula as the user gave it, the result cache is keyed by it
+static const InputFormula& user_input(const AppMCPrivateData* data)
+{
+    return data->preprocessed ? data->orig_input : data->counter.input;
+}
+
+static void preprocess(AppMCPrivateData* data)
+{
+    const InputFormula& in = data->counter.input;
+    const string& cache_dir = data->conf.preprocess_cache;
+    Preprocessor pre(in, data->conf.sampling_set, data->conf.verb);
+    if (!cache_dir.empty() && pre.read_cache(cache_dir)) {
+        if (data->conf.verb) {
+            cout << "c [appmc] Preprocessed formula with "
+            << pre.formula.clauses.size() << " clauses read from the cache" << endl;
+        }
+    } else {
+        pre.run();
+        if (!cache_dir.empty()) {
+            pre.write_cache(cache_dir);
+        }
+    }
+
+    data->removed.assign(in.num_vars, 0);
+    for (const uint32_t v: pre.removed_vars()) {
+        data->removed[v] = 1;
+    }
+    data->orig_input = in;
+    data->preprocessed = true;
+    data->counter.replace_input(pre.formula, data->conf);
+}
+
 DLL_PUBLIC void setup_sampling_vars(AppMCPrivateData* data)
 {
+    if (data->conf.sampling_set.empty() && data->conf.ind_support) {
+        data->conf.sampling_set = find_ind_support(data);
+    }
     if (data->conf.sampling_set.empty()) {
         if (data->conf.verb) {
             cout
             << "c [appmc] WARNING! Sampling set was not declared! We will be **VERY** slow"
             << endl;
         }
-        for (size_t i = 0; i < data->counter.solver->nVars(); i++) {
+        for (size_t i = 0; i < data->counter.input.num_vars; i++) {
             data->conf.sampling_set.push_back(i);
         }
     }
@@ -164,6 +230,43 @@ DLL_PUBLIC void AppMC::set_sparse(uint32_t sparse)
     data->conf.sparse = sparse;
 }
 
+DLL_PUBLIC void AppMC::set_fast_hit(uint32_t fast_hit)
+{
+    data->conf.fast_hit = fast_hit;
+}
+
+DLL_PUBLIC void AppMC::set_cube_threads(uint32_t threads, uint32_t cube_vars)
+{
+    data->conf.cube_threads = threads;
+    data->conf.cube_vars = cube_vars;
+}
+
+DLL_PUBLIC void AppMC::set_compact(uint64_t compact_lits)
+{
+    data->conf.compact_lits = compact_lits;
+}
+
+DLL_PUBLIC void AppMC::set_enum_engine(uint32_t enum_engine, uint64_t confl_budget)
+{
+    data->conf.enum_engine = enum_engine;
+    data->conf.enum_confl = confl_budget;
+}
+
+DLL_PUBLIC void AppMC::set_num_threads(uint32_t num_threads)
+{
+    data->conf.num_threads = num_threads;
+}
+
+DLL_PUBLIC void AppMC::set_checkpoint_file(const string& checkpoint_file)
+{
+    data->conf.checkpoint_file = checkpoint_file;
+}
+
+DLL_PUBLIC void AppMC::set_resume(uint32_t resume)
+{
+    data->conf.resume = resume;
+}
+
 DLL_PUBLIC double AppMC::get_epsilon()
 {
     return data->conf.epsilon;
@@ -184,43 +287,292 @@ DLL_PUBLIC double AppMC::get_var_elim_ratio()
     return data->conf.var_elim_ratio;
 }
 
+DLL_PUBLIC void AppMC::set_ind_support(uint32_t ind_support)
+{
+    data->conf.ind_support = ind_support;
+}
+
+DLL_PUBLIC void AppMC::set_ind_support_cache(const std::string& dir)
+{
+    data->conf.ind_support_cache = dir;
+}
+
+DLL_PUBLIC void AppMC::set_result_cache(const std::string& dir)
+{
+    data->conf.result_cache = dir;
+}
+
+DLL_PUBLIC void AppMC::set_preprocess(uint32_t preprocess)
+{
+    data->conf.preprocess = preprocess;
+}
+
+DLL_PUBLIC void AppMC::set_preprocess_cache(const std::string& dir)
+{
+    data->conf.preprocess_cache = dir;
+}
+
+DLL_PUBLIC uint32_t AppMC::get_preprocess()
+{
+    return data->conf.preprocess;
+}
+
+DLL_PUBLIC void AppMC::set_components(uint32_t components)
+{
+    data->conf.components = components;
+}
+
+DLL_PUBLIC uint32_t AppMC::get_components()
+{
+    return data->conf.components;
+}
+
+DLL_PUBLIC uint32_t AppMC::get_ind_support()
+{
+    return data->conf.ind_support;
+}
+
 DLL_PUBLIC uint32_t AppMC::get_sparse()
 {
     return data->conf.sparse;
 }
 
+DLL_PUBLIC uint32_t AppMC::get_fast_hit()
+{
+    return data->conf.fast_hit;
+}
+
+DLL_PUBLIC uint32_t AppMC::get_enum_engine()
+{
+    return data->conf.enum_engine;
+}
+
+DLL_PUBLIC uint64_t AppMC::get_enum_confl()
+{
+    return data->conf.enum_confl;
+}
+
+DLL_PUBLIC uint64_t AppMC::get_compact()
+{
+    return data->conf.compact_lits;
+}
+
+DLL_PUBLIC uint32_t AppMC::get_cube_threads()
+{
+    return data->conf.cube_threads;
+}
+
+DLL_PUBLIC uint32_t AppMC::get_cube_vars()
+{
+    return data->conf.cube_vars;
+}
+
 DLL_PUBLIC uint32_t AppMC::get_seed()
 {
     return data->conf.seed;
 }
 
+DLL_PUBLIC uint32_t AppMC::get_num_threads()
+{
+    return data->conf.num_threads;
+}
+
 DLL_PUBLIC bool AppMC::get_reuse_models()
 {
     return data->conf.reuse_models;
 }
 
+static void check_conf(const Config& conf)
+{
+
+    if (conf.epsilon < 0.0) {
+        throw AppMCError("invalid epsilon");
+    }
+
+    if (conf.delta <= 0.0 || conf.delta > 1.0) {
+        throw AppMCError("invalid delta");
+    }
+
+    if (conf.num_threads == 0) {
+        throw AppMCError("number of threads must be at least 1");
+    }
+
+    if (conf.cube_threads == 0 || conf.cube_vars > 20) {
+        throw AppMCError("cube threads must be at least 1, cube variables at most 20");
+    }
+}
+
+static void check_lits(AppMCPrivateData* data, const vector<CMSat::Lit>& lits)
+{
+    for (const CMSat::Lit l: lits) {
+        if (l.var() >= data->counter.input.num_vars) {
+            std::stringstream ss;
+            ss << "literal " << l << " is over a variable that does not exist";
+            throw AppMCError(ss.str());
+        }
+        if (data->preprocessed && data->removed[l.var()]) {
+            std::stringstream ss;
+            ss << "literal " << l << " is over a variable removed by preprocessing";
+            throw AppMCError(ss.str());
+        }
+    }
+}
+
+//Stats of one count, from those of all counts before and after it
+static Stats stats_since(const Stats& before, const Stats& after)
+{
+    Stats st = after;
+    PhaseTime* from[] = {&st.initial_check, &st.simplify, &st.hash_add
+        , &st.ban_add, &st.sat, &st.total};
+    const PhaseTime* sub[] = {&before.initial_check, &before.simplify
+        , &before.hash_add, &before.ban_add, &before.sat, &before.total};
+    for (size_t i = 0; i < 6; i++) {
+        from[i]->cpu -= sub[i]->cpu;
+        from[i]->wall -= sub[i]->wall;
+    }
+    st.sat_calls -= before.sat_calls;
+    st.solutions -= before.solutions;
+    st.repeated -= before.repeated;
+    st.xors_added -= before.xors_added;
+    st.cells -= before.cells;
+    st.compactions -= before.compactions;
+    st.cache_hits = 0;
+    return st;
+}
+
+//Estimates cut short by a time budget, or that depend on a checkpoint,
+//are not cached
+static bool use_result_cache(const Config& conf)
+{
+    return !conf.result_cache.empty()
+        && conf.max_wall_time == 0
+        && conf.checkpoint_file.empty();
+}
+
 DLL_PUBLIC ApproxMC::SolCount AppMC::count()
 {
     if (data->conf.verb > 2) {
         cout << "c [appmc] using seed: " << data->conf.seed << endl;
     }
+    check_conf(data->conf);
+
+    //Looked up before the independent support is searched for, which the
+    //count does not depend on
+    const bool use_cache = use_result_cache(data->conf);
+    uint64_t key = 0;
+    if (use_cache) {
+        key = ResultCache::key(user_input(data), data->conf);
+        SolCount sol_count;
+        Stats st;
+        if (ResultCache::read(data->conf.result_cache, key
+            , user_input(data), sol_count, st)
+        ) {
+            if (data->conf.verb) {
+                cout << "c [appmc] Count read from the result cache" << endl;
+            }
+            data->counter.add_cached_stats(st);
+            if (data->conf.progress) {
+                Progress p;
+                p.measurements_done = 1;
+                p.measurements_total = 1;
+                p.estimate = sol_count;
+                p.confidence = 1.0 - data->conf.delta;
+                data->conf.progress(p);
+            }
+            return sol_count;
+        }
+    }
 
-    if (data->conf.epsilon < 0.0) {
-        cout << "[appmc] ERROR: invalid epsilon" << endl;
-        exit(-1);
+    setup_sampling_vars(data);
+    //Only before the first count: the literals of later assumptions and
+    //clauses may be over the variables removed
+    if (data->conf.preprocess && !data->preprocessed
+        && data->counter.num_counts == 0
+        && data->conf.assumptions.empty()
+        && !data->counter.solver_shared
+    ) {
+        preprocess(data);
+    }
+    const Stats before = data->counter.get_stats();
+    SolCount sol_count = data->counter.solve(data->conf);
+    if (use_cache && sol_count.valid && !data->counter.was_stopped) {
+        ResultCache::write(data->conf.result_cache, key, user_input(data)
+            , sol_count, stats_since(before, data->counter.get_stats()));
+    }
+    return sol_count;
+}
+
+DLL_PUBLIC ApproxMC::Stats AppMC::get_stats() const
+{
+    return data->counter.get_stats();
+}
+
+DLL_PUBLIC ApproxMC::SolCount AppMC::count(double max_wall_time, ProgressCallback progress)
+{
+    if (max_wall_time < 0.0) {
+        throw AppMCError("invalid time budget");
+    }
+
+    const Config old_conf = data->conf;
+    data->conf.max_wall_time = max_wall_time;
+    data->conf.progress = progress;
+    SolCount sol_count;
+    try {
+        sol_count = count();
+    } catch (...) {
+        data->conf.max_wall_time = old_conf.max_wall_time;
+        data->conf.progress = old_conf.progress;
+        throw;
     }
+    data->conf.max_wall_time = old_conf.max_wall_time;
+    data->conf.progress = old_conf.progress;
+    return sol_count;
+}
 
-    if (data->conf.delta <= 0.0 || data->conf.delta > 1.0) {
-        cout << "[appmc] ERROR: invalid delta" << endl;
-        exit(-1);
+DLL_PUBLIC ApproxMC::SolCount AppMC::count(const vector<CMSat::Lit>& assumptions)
+{
+    check_lits(data, assumptions);
+    const Config old_conf = data->conf;
+    data->conf.assumptions = assumptions;
+    SolCount sol_count;
+    try {
+        sol_count = count();
+    } catch (...) {
+        data->conf.assumptions = old_conf.assumptions;
+        throw;
     }
+    data->conf.assumptions = old_conf.assumptions;
+    return sol_count;
+}
 
+DLL_PUBLIC vector<ApproxMC::SolCount> AppMC::count_marginals(const vector<CMSat::Lit>& lits)
+{
+    check_conf(data->conf);
+    check_lits(data, lits);
     setup_sampling_vars(data);
+    return data->counter.count_marginals(data->conf, lits);
+}
 
-    SolCount sol_count = data->counter.solve(data->conf);
+DLL_PUBLIC ApproxMC::SolCount AppMC::get_partial_count(double* confidence)
+{
+    double conf = 0;
+    SolCount sol_count = data->counter.calc_partial_count(conf);
+    if (confidence) {
+        *confidence = conf;
+    }
     return sol_count;
 }
 
+DLL_PUBLIC void AppMC::interrupt()
+{
+    data->counter.interrupt();
+}
+
+DLL_PUBLIC void AppMC::write_checkpoint()
+{
+    data->counter.save_checkpoint();
+}
+
 DLL_PUBLIC void AppMC::set_projection_set(const vector<uint32_t>& vars)
 {
     data->conf.sampling_set = vars;
@@ -228,27 +580,65 @@ DLL_PUBLIC void AppMC::set_projection_set(const vector<uint32_t>& vars)
 
 
 DLL_PUBLIC uint32_t AppMC::nVars() {
-    return data->counter.solver->nVars();
+    return data->counter.input.num_vars;
 }
 
 DLL_PUBLIC void AppMC::new_vars(uint32_t num)
 {
+    //The solver's variables past the formula's are the hashes' by now
+    if (data->counter.num_counts > 0) {
+        throw AppMCError("variables cannot be added after counting");
+    }
     data->counter.solver->new_vars(num);
+    data->counter.input.num_vars += num;
 }
 
 DLL_PUBLIC void AppMC::new_var()
 {
-    data->counter.solver->new_var();
+    new_vars(1);
 }
 
 DLL_PUBLIC void AppMC::add_clause(const vector<CMSat::Lit>& lits)
 {
+    if (data->preprocessed) {
+        check_lits(data, lits);
+        data->orig_input.clauses.push_back(lits);
+    }
     data->counter.solver->add_clause(lits);
+    data->counter.input.clauses.push_back(lits);
+}
+
+DLL_PUBLIC void AppMC::add_clauses(const vector<CMSat::Lit>& lits)
+{
+    vector<CMSat::Lit> cl;
+    for (const CMSat::Lit l: lits) {
+        if (l != CMSat::lit_Undef) {
+            cl.push_back(l);
+            continue;
+        }
+        if (data->preprocessed) {
+            check_lits(data, cl);
+            data->orig_input.clauses.push_back(cl);
+        }
+        data->counter.solver->add_clause(cl);
+        data->counter.input.clauses.push_back(cl);
+        cl.clear();
+    }
+    assert(cl.empty() && "last clause must be followed by lit_Undef");
 }
 
 DLL_PUBLIC void AppMC::add_xor_clause(const vector<uint32_t>& vars, bool rhs)
 {
+    if (data->preprocessed) {
+        vector<CMSat::Lit> lits;
+        for (const uint32_t v: vars) {
+            lits.push_back(CMSat::Lit(v, false));
+        }
+        check_lits(data, lits);
+        data->orig_input.xors.push_back(std::make_pair(vars, rhs));
+    }
     data->counter.solver->add_xor_clause(vars, rhs);
+    data->counter.input.xors.push_back(std::make_pair(vars, rhs));
 }
 
 DLL_PUBLIC void AppMC::set_detach_warning()
@@ -258,6 +648,7 @@ DLL_PUBLIC void AppMC::set_detach_warning()
 
 DLL_PUBLIC CMSat::SATSolver* AppMC::get_solver()
 {
+    data->counter.solver_shared = true;
     return data->counter.solver;
 }
 
@@ -31,6 +31,8 @@
 #define APPROXMC_H__
 
 #include <cstdint>
+#include <functional>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <cryptominisat5/cryptominisat.h>
@@ -38,6 +40,18 @@
 
 namespace ApproxMC {
 
+//Thrown on invalid settings, literals or checkpoints, and on files that
+//cannot be opened. The library never exits the process
+#ifdef _WIN32
+class __declspec(dllexport) AppMCError : public std::runtime_error
+#else
+class AppMCError : public std::runtime_error
+#endif
+{
+public:
+    explicit AppMCError(const std::string& msg) : std::runtime_error(msg) {}
+};
+
 #ifdef _WIN32
 struct __declspec(dllexport) SolCount
 #else
@@ -55,7 +69,65 @@ struct SolCount
     uint32_t cellSolCount = 0;
 };
 
+//Handed to the progress callback after every finished measurement
+#ifdef _WIN32
+struct __declspec(dllexport) Progress
+#else
+struct Progress
+#endif
+{
+    uint32_t measurements_done = 0;
+    uint32_t measurements_total = 0;
+    SolCount estimate; //median of the measurements so far
+    double confidence = 0; //confidence the number of measurements done implies
+    double wall_time = 0; //seconds since counting started
+};
+typedef std::function<void(const Progress&)> ProgressCallback;
+
+//CPU and wall-clock seconds spent in one phase of counting. With more than
+//one thread, the times of the threads are added up
+#ifdef _WIN32
+struct __declspec(dllexport) PhaseTime
+#else
+struct PhaseTime
+#endif
+{
+    double cpu = 0;
+    double wall = 0;
+};
+
+//Statistics of all count() calls made so far. The initial check contains
+//the simplification and the SAT calls made during it
+#ifdef _WIN32
+struct __declspec(dllexport) Stats
+#else
+struct Stats
+#endif
+{
+    PhaseTime initial_check; //looking for threshold+1 solutions, no hashes
+    PhaseTime simplify;
+    PhaseTime hash_add; //generating and adding XOR hashes
+    PhaseTime ban_add; //adding banning clauses for models found earlier
+    PhaseTime sat; //SAT calls
+    PhaseTime total; //all of count(), cpu is that of the whole process
+
+    uint64_t sat_calls = 0;
+    uint64_t solutions = 0; //found by SAT calls
+    uint64_t repeated = 0; //models found earlier that were reused
+    uint64_t xors_added = 0;
+    uint64_t cells = 0; //cells counted, i.e. bounded_sol_count calls
+    uint64_t compactions = 0; //solver rebuilt to drop old hashes and banning clauses
+    uint64_t peak_rss = 0; //bytes, largest resident set seen
+    uint64_t cache_hits = 0; //counts read from the result cache, with their stats
+};
+
 struct AppMCPrivateData;
+
+//Instances share no mutable state, so any number of them can count at the
+//same time on different threads of one process. One instance must only be
+//used by one thread at a time, apart from the calls marked as safe from
+//another thread. Errors throw AppMCError, the instance can be used again
+//afterwards
 #ifdef _WIN32
 class __declspec(dllexport) AppMC
 #else
@@ -68,8 +140,32 @@ public:
     std::string get_version_info();
     void set_projection_set(const std::vector<uint32_t>& vars);
     ApproxMC::SolCount count();
+    //Anytime counting: stops after max_wall_time seconds (0 = no limit) and
+    //returns the median of the measurements finished by then. The estimate
+    //is only (1+eps, delta) approximate if all measurements were done
+    ApproxMC::SolCount count(double max_wall_time, ProgressCallback progress = ProgressCallback());
+    //Counts the solutions that satisfy all of 'assumptions'. The solver,
+    //simplified once, and what it learnt are kept between counts, so many
+    //such queries on the same formula are cheap. Variables cannot be added
+    //once counting has started
+    ApproxMC::SolCount count(const std::vector<CMSat::Lit>& assumptions);
+    //Counts the solutions with each of 'lits' set, one count per literal.
+    //The literals are spread over the threads set with set_num_threads(),
+    //each reusing its solver and hashes from one literal to the next
+    std::vector<ApproxMC::SolCount> count_marginals(const std::vector<CMSat::Lit>& lits);
+    //Estimate from the measurements finished so far. Safe to call from
+    //another thread while count() runs. Not (1+eps, delta) approximate.
+    ApproxMC::SolCount get_partial_count(double* confidence = NULL);
+    void write_checkpoint();
+    //Makes count() return as soon as possible, with the estimate from the
+    //measurements finished by then. Safe to call from another thread
+    void interrupt();
+    //Statistics of all counts so far. Call it when count() is not running
+    ApproxMC::Stats get_stats() const;
     void new_vars(uint32_t num);
     void add_clause(const std::vector<CMSat::Lit>& lits);
+    //Adds many clauses at once, separated by CMSat::lit_Undef
+    void add_clauses(const std::vector<CMSat::Lit>& lits);
 
     //Main options
     void set_up_log(std::string log_file_name);
@@ -78,6 +174,28 @@ public:
     void set_seed(uint32_t seed);
     void set_epsilon(double epsilon);
     void set_delta(double delta);
+    void set_num_threads(uint32_t num_threads);
+    void set_checkpoint_file(const std::string& checkpoint_file);
+    void set_resume(uint32_t resume);
+    //Without a projection set, count on an independent support found by
+    //definability checks instead of on all variables. With a cache
+    //directory, supports found are kept there by formula fingerprint
+    void set_ind_support(uint32_t ind_support);
+    void set_ind_support_cache(const std::string& dir);
+    //Before the first count, fix units, substitute equivalent literals and
+    //eliminate variables outside the projection set. Clauses and
+    //assumptions over the removed variables are refused afterwards. With
+    //a cache directory, the reduced formula is kept there
+    void set_preprocess(uint32_t preprocess);
+    void set_preprocess_cache(const std::string& dir);
+    //Count the variable-disjoint parts of the formula separately and
+    //multiply the counts. Not done with assumptions, checkpoints or a
+    //time budget
+    void set_components(uint32_t components);
+    //Directory of finished counts, keyed by a fingerprint of the formula,
+    //projection set, assumptions and parameters. Counts found there are
+    //returned without counting. Not used with a time budget or checkpoints
+    void set_result_cache(const std::string& dir);
     CMSat::SATSolver* get_solver();
 
     //Misc options -- do NOT to change unless you know what you are doing!
@@ -88,6 +206,23 @@ public:
     void set_reuse_models(uint32_t reuse_models);
     void set_force_sol_extension(uint32_t force_sol_extension);
     void set_sparse(uint32_t sparse);
+    //Jump by log2(threshold/cell size) in the hash search instead of to
+    //the midpoint, and start each measurement where the earlier ones
+    //suggest the threshold is crossed
+    void set_fast_hit(uint32_t fast_hit);
+    //Enumerate the solutions of a cell by flipping the sampling set values
+    //of the last model under assumptions, instead of adding a banning
+    //clause per model. With a conflict budget, cells that run out of it
+    //fall back to banning clauses
+    void set_enum_engine(uint32_t enum_engine, uint64_t confl_budget = 0);
+    //Rebuild the solver from the formula between measurements once the
+    //hashes and banning clauses no longer used hold this many literals and
+    //more than the formula does. 0 = never. Never done after get_solver()
+    void set_compact(uint64_t compact_lits);
+    //Split every cell into 2^cube_vars cubes on sampling set variables and
+    //enumerate them on 'threads' threads, each with its own solver. With
+    //cube_vars 0, it is chosen from the number of threads
+    void set_cube_threads(uint32_t threads, uint32_t cube_vars = 0);
     void set_simplify(uint32_t simplify);
 
     //Querying default values
@@ -98,7 +233,17 @@ public:
     uint32_t get_simplify();
     double get_var_elim_ratio();
     uint32_t get_sparse();
+    uint32_t get_fast_hit();
+    uint32_t get_enum_engine();
+    uint64_t get_enum_confl();
+    uint64_t get_compact();
+    uint32_t get_cube_threads();
+    uint32_t get_cube_vars();
+    uint32_t get_ind_support();
+    uint32_t get_preprocess();
+    uint32_t get_components();
     bool get_reuse_models();
+    uint32_t get_num_threads();
 
     //Misc
     uint32_t nVars();
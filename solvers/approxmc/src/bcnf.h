@@ -0,0 +1,361 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/*
+ Binary CNF (.bcnf): a DIMACS CNF stored so it can be used straight from a
+ memory mapping, without tokenizing. This header is plain C, so solvers
+ written in C can read the format too.
+
+ Numbers are in the byte order of the machine that wrote the file, and
+ byte_order holds BCNF_BYTE_ORDER in it, so a file from a machine of the
+ other byte order is rejected. The file is a bcnf_header followed by
+ these sections, each starting at the offset the header gives and aligned
+ to 8 bytes:
+   offsets:    uint64_t[num_clauses+1], clause i is lits[offsets[i]..offsets[i+1])
+   lits:       uint32_t[num_lits], literal of var v (0-based) is 2*v + negated
+   projection: uint32_t[num_proj], 0-based vars of the "c ind" lines
+   weights:    double[2*num_vars], weight of v then of -v, as "c weights"
+ The fingerprint is a 64-bit FNV-1a hash of the four sections, so two files
+ with the same clauses, projection and weights have the same fingerprint.
+ bcnf_check recomputes it, so a file damaged after it was written is
+ rejected.
+ source_size and source_mtime_ns are those of the DIMACS file it was made
+ from, so it can be told whether the .bcnf is still up to date. The time is
+ in nanoseconds, so a file rewritten within the same second is told apart
+ too, where the file system keeps such times.
+*/
+
+#ifndef BCNF_H_
+#define BCNF_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define BCNF_MAGIC "BCNF"
+#define BCNF_VERSION 2
+#define BCNF_BYTE_ORDER 0x0102030405060708ULL
+
+#define BCNF_HAS_PROJECTION 1
+#define BCNF_HAS_WEIGHTS 2
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t byte_order;
+    uint64_t flags;
+    uint64_t num_vars;
+    uint64_t num_clauses;
+    uint64_t num_lits;
+    uint64_t num_proj;
+    uint64_t fingerprint;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t offsets_at;
+    uint64_t lits_at;
+    uint64_t proj_at;
+    uint64_t weights_at;
+    uint64_t file_size;
+} bcnf_header;
+
+/* A mapped .bcnf. The pointers point into the mapping */
+typedef struct {
+    void* mapped;
+    size_t mapped_size;
+    const bcnf_header* header;
+    const uint64_t* offsets;
+    const uint32_t* lits;
+    const uint32_t* proj;
+    const double* weights;
+} bcnf_file;
+
+static inline uint64_t bcnf_fnv1a(uint64_t h, const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static inline uint64_t bcnf_fingerprint(
+    const uint64_t* offsets, uint64_t num_clauses,
+    const uint32_t* lits, uint64_t num_lits,
+    const uint32_t* proj, uint64_t num_proj,
+    const double* weights, uint64_t num_weights)
+{
+    uint64_t h = 14695981039346656037ULL;
+    h = bcnf_fnv1a(h, offsets, (num_clauses+1)*sizeof(uint64_t));
+    h = bcnf_fnv1a(h, lits, num_lits*sizeof(uint32_t));
+    h = bcnf_fnv1a(h, proj, num_proj*sizeof(uint32_t));
+    h = bcnf_fnv1a(h, weights, num_weights*sizeof(double));
+    return h;
+}
+
+/* Modification time of a file in nanoseconds */
+static inline int64_t bcnf_mtime_ns(const struct stat* st)
+{
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec*1000000000LL + st->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    return (int64_t)st->st_mtime*1000000000LL;
+#else
+    return (int64_t)st->st_mtim.tv_sec*1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
+/* Name of the .bcnf next to a DIMACS file: its extension replaced by .bcnf.
+   The result must be freed */
+static inline char* bcnf_name_for(const char* dimacs_name)
+{
+    const char* dot = strrchr(dimacs_name, '.');
+    const char* slash = strrchr(dimacs_name, '/');
+    size_t base_len = (dot != NULL && (slash == NULL || dot > slash))
+        ? (size_t)(dot - dimacs_name) : strlen(dimacs_name);
+    char* name = (char*)malloc(base_len + 6);
+    memcpy(name, dimacs_name, base_len);
+    strcpy(name + base_len, ".bcnf");
+    return name;
+}
+
+static inline int bcnf_is_bcnf_name(const char* name)
+{
+    size_t len = strlen(name);
+    return len >= 5 && strcmp(name + len - 5, ".bcnf") == 0;
+}
+
+static inline void bcnf_unmap(bcnf_file* f)
+{
+#ifndef _WIN32
+    if (f->mapped != NULL) {
+        munmap(f->mapped, f->mapped_size);
+    }
+#endif
+    memset(f, 0, sizeof(*f));
+}
+
+/* Whether count elements of the given size starting at 'at' fit in the
+   file. Divides rather than multiplies, so a crafted header cannot
+   overflow past the check */
+static inline int bcnf_fits(uint64_t at, uint64_t count, uint64_t size,
+    uint64_t file_size)
+{
+    return at <= file_size && count <= (file_size - at)/size;
+}
+
+/* Maps a .bcnf and checks its layout. If source is not NULL, the .bcnf is
+   only used if it was made from the current version of that DIMACS file.
+   Returns 0 on success */
+static inline int bcnf_map(const char* name, const char* source, bcnf_file* f)
+{
+#ifdef _WIN32
+    (void)name;
+    (void)source;
+    memset(f, 0, sizeof(*f));
+    return -1;
+#else
+    struct stat st;
+    struct stat src_st;
+    const bcnf_header* h;
+    int fd;
+    void* m;
+
+    memset(f, 0, sizeof(*f));
+    if (source != NULL && stat(source, &src_st) != 0) {
+        return -1;
+    }
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(bcnf_header)) {
+        close(fd);
+        return -1;
+    }
+    m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        return -1;
+    }
+    f->mapped = m;
+    f->mapped_size = st.st_size;
+
+    h = (const bcnf_header*)m;
+    if (memcmp(h->magic, BCNF_MAGIC, 4) != 0
+        || h->byte_order != BCNF_BYTE_ORDER
+        || h->version != BCNF_VERSION
+        || h->file_size != (uint64_t)st.st_size
+        || h->num_lits > 0xffffffffULL
+        || h->num_clauses == UINT64_MAX
+        || !bcnf_fits(h->offsets_at, h->num_clauses+1, sizeof(uint64_t), h->file_size)
+        || !bcnf_fits(h->lits_at, h->num_lits, sizeof(uint32_t), h->file_size)
+        || !bcnf_fits(h->proj_at, h->num_proj, sizeof(uint32_t), h->file_size)
+        || ((h->flags & BCNF_HAS_WEIGHTS)
+            && !bcnf_fits(h->weights_at, h->num_vars, 2*sizeof(double), h->file_size))
+        || (h->offsets_at | h->lits_at | h->proj_at | h->weights_at) % 8 != 0
+        || (source != NULL
+            && (h->source_size != (uint64_t)src_st.st_size
+                || h->source_mtime_ns != bcnf_mtime_ns(&src_st)))
+    ) {
+        bcnf_unmap(f);
+        return -1;
+    }
+
+    f->header = h;
+    f->offsets = (const uint64_t*)((const char*)m + h->offsets_at);
+    f->lits = (const uint32_t*)((const char*)m + h->lits_at);
+    f->proj = (const uint32_t*)((const char*)m + h->proj_at);
+    f->weights = (h->flags & BCNF_HAS_WEIGHTS)
+        ? (const double*)((const char*)m + h->weights_at) : NULL;
+    if (f->offsets[h->num_clauses] != h->num_lits) {
+        bcnf_unmap(f);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+/* Checks that every literal and projection var is below num_vars and the
+   clause offsets are in order, so a corrupt file cannot cause out of
+   bounds accesses, and that the sections still match the fingerprint.
+   Returns 0 if the contents are sound */
+static inline int bcnf_check(const bcnf_file* f)
+{
+    const bcnf_header* h = f->header;
+    uint64_t i;
+    if (bcnf_fingerprint(f->offsets, h->num_clauses, f->lits, h->num_lits,
+            f->proj, h->num_proj,
+            f->weights, f->weights != NULL ? 2*h->num_vars : 0)
+        != h->fingerprint
+    ) {
+        return -1;
+    }
+    for (i = 0; i < h->num_clauses; i++) {
+        if (f->offsets[i] > f->offsets[i+1]) {
+            return -1;
+        }
+    }
+    for (i = 0; i < h->num_lits; i++) {
+        if (f->lits[i]/2 >= h->num_vars) {
+            return -1;
+        }
+    }
+    for (i = 0; i < h->num_proj; i++) {
+        if (f->proj[i] >= h->num_vars) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline uint64_t bcnf_align8(uint64_t at)
+{
+    return (at + 7) & ~(uint64_t)7;
+}
+
+/* Writes a .bcnf, first to name.tmp then renaming it, so readers never see
+   a half-written file. weights is NULL or holds 2*num_vars values.
+   Returns 0 on success */
+static inline int bcnf_write(
+    const char* name,
+    uint64_t num_vars,
+    const uint64_t* offsets, uint64_t num_clauses,
+    const uint32_t* lits,
+    const uint32_t* proj, uint64_t num_proj, int has_proj,
+    const double* weights,
+    uint64_t source_size, int64_t source_mtime_ns)
+{
+    bcnf_header h;
+    const uint64_t num_lits = offsets[num_clauses];
+    static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    char* tmp_name;
+    FILE* out;
+    int ok;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BCNF_MAGIC, 4);
+    h.version = BCNF_VERSION;
+    h.byte_order = BCNF_BYTE_ORDER;
+    h.flags = (has_proj ? BCNF_HAS_PROJECTION : 0) | (weights ? BCNF_HAS_WEIGHTS : 0);
+    h.num_vars = num_vars;
+    h.num_clauses = num_clauses;
+    h.num_lits = num_lits;
+    h.num_proj = num_proj;
+    h.fingerprint = bcnf_fingerprint(offsets, num_clauses, lits, num_lits,
+        proj, num_proj, weights, weights ? 2*num_vars : 0);
+    h.source_size = source_size;
+    h.source_mtime_ns = source_mtime_ns;
+    h.offsets_at = bcnf_align8(sizeof(h));
+    h.lits_at = bcnf_align8(h.offsets_at + (num_clauses+1)*sizeof(uint64_t));
+    h.proj_at = bcnf_align8(h.lits_at + num_lits*sizeof(uint32_t));
+    h.weights_at = bcnf_align8(h.proj_at + num_proj*sizeof(uint32_t));
+    h.file_size = h.weights_at + (weights ? 2*num_vars*sizeof(double) : 0);
+
+    tmp_name = (char*)malloc(strlen(name) + 5);
+    strcpy(tmp_name, name);
+    strcat(tmp_name, ".tmp");
+    out = fopen(tmp_name, "wb");
+    if (out == NULL) {
+        free(tmp_name);
+        return -1;
+    }
+
+    ok = fwrite(&h, sizeof(h), 1, out) == 1;
+    ok &= fwrite(zeros, 1, h.offsets_at - sizeof(h), out) == h.offsets_at - sizeof(h);
+    ok &= fwrite(offsets, sizeof(uint64_t), num_clauses+1, out) == num_clauses+1;
+    ok &= fwrite(zeros, 1, h.lits_at - (h.offsets_at + (num_clauses+1)*sizeof(uint64_t)), out)
+        == h.lits_at - (h.offsets_at + (num_clauses+1)*sizeof(uint64_t));
+    ok &= fwrite(lits, sizeof(uint32_t), num_lits, out) == num_lits;
+    ok &= fwrite(zeros, 1, h.proj_at - (h.lits_at + num_lits*sizeof(uint32_t)), out)
+        == h.proj_at - (h.lits_at + num_lits*sizeof(uint32_t));
+    ok &= fwrite(proj, sizeof(uint32_t), num_proj, out) == num_proj;
+    ok &= fwrite(zeros, 1, h.weights_at - (h.proj_at + num_proj*sizeof(uint32_t)), out)
+        == h.weights_at - (h.proj_at + num_proj*sizeof(uint32_t));
+    if (weights) {
+        ok &= fwrite(weights, sizeof(double), 2*num_vars, out) == 2*num_vars;
+    }
+    ok &= fclose(out) == 0;
+    if (!ok || rename(tmp_name, name) != 0) {
+        remove(tmp_name);
+        free(tmp_name);
+        return -1;
+    }
+    free(tmp_name);
+    return 0;
+}
+
+#endif /* BCNF_H_ */
@@ -0,0 +1,225 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "components.h"
+#include <limits>
+#include <map>
+
+using std::vector;
+using std::map;
+using namespace CMSat;
+
+Components::Components(const InputFormula& _in, const vector<uint32_t>& _sampling_set) :
+    in(_in),
+    sampling_set(_sampling_set)
+{
+}
+
+static inline bool is_true(const lbool val, const Lit l)
+{
+    return val != l_Undef && ((val == l_True) ^ l.sign());
+}
+
+//Plain fixpoint of unit propagation, only run once per count
+bool Components::propagate()
+{
+    value.assign(in.num_vars, l_Undef);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& cl: in.clauses) {
+            uint32_t num_undef = 0;
+            Lit last = lit_Undef;
+            bool sat = false;
+            for (const Lit l: cl) {
+                const lbool val = value[l.var()];
+                if (val == l_Undef) {
+                    num_undef++;
+                    last = l;
+                } else if (is_true(val, l)) {
+                    sat = true;
+                    break;
+                }
+            }
+            if (sat) {
+                continue;
+            }
+            if (num_undef == 0) {
+                return false;
+            }
+            if (num_undef == 1) {
+                value[last.var()] = last.sign() ? l_False : l_True;
+                changed = true;
+            }
+        }
+
+        for (const auto& x: in.xors) {
+            uint32_t num_undef = 0;
+            uint32_t last = 0;
+            bool rhs = x.second;
+            for (const uint32_t v: x.first) {
+                if (value[v] == l_Undef) {
+                    num_undef++;
+                    last = v;
+                } else {
+                    rhs ^= value[v] == l_True;
+                }
+            }
+            if (num_undef == 0 && rhs) {
+                return false;
+            }
+            if (num_undef == 1) {
+                value[last] = rhs ? l_True : l_False;
+                changed = true;
+            }
+        }
+    }
+    return true;
+}
+
+uint32_t Components::find(uint32_t v)
+{
+    while (root[v] != v) {
+        root[v] = root[root[v]];
+        v = root[v];
+    }
+    return v;
+}
+
+void Components::join(uint32_t a, uint32_t b)
+{
+    a = find(a);
+    b = find(b);
+    if (a != b) {
+        root[a] = b;
+    }
+}
+
+bool Components::split()
+{
+    comps.clear();
+    free_sampling_vars = 0;
+    if (!propagate()) {
+        return false;
+    }
+
+    //What is left of the clauses and XORs once the units are taken out
+    vector<vector<Lit>> clauses;
+    for (const auto& cl: in.clauses) {
+        vector<Lit> rest;
+        bool sat = false;
+        for (const Lit l: cl) {
+            const lbool val = value[l.var()];
+            if (val == l_Undef) {
+                rest.push_back(l);
+            } else if (is_true(val, l)) {
+                sat = true;
+                break;
+            }
+        }
+        if (!sat) {
+            clauses.push_back(rest);
+        }
+    }
+    vector<std::pair<vector<uint32_t>, bool>> xors;
+    for (const auto& x: in.xors) {
+        vector<uint32_t> rest;
+        bool rhs = x.second;
+        for (const uint32_t v: x.first) {
+            if (value[v] == l_Undef) {
+                rest.push_back(v);
+            } else {
+                rhs ^= value[v] == l_True;
+            }
+        }
+        if (!rest.empty()) {
+            xors.push_back(std::make_pair(rest, rhs));
+        }
+    }
+
+    root.resize(in.num_vars);
+    vector<char> occurs(in.num_vars, 0);
+    for (uint32_t v = 0; v < in.num_vars; v++) {
+        root[v] = v;
+    }
+    for (const auto& cl: clauses) {
+        for (const Lit l: cl) {
+            occurs[l.var()] = 1;
+            join(l.var(), cl[0].var());
+        }
+    }
+    for (const auto& x: xors) {
+        for (const uint32_t v: x.first) {
+            occurs[v] = 1;
+            join(v, x.first[0]);
+        }
+    }
+
+    //Number the components and their variables
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    map<uint32_t, uint32_t> comp_of_root;
+    vector<uint32_t> new_var(in.num_vars, none);
+    vector<uint32_t> comp_of(in.num_vars, none);
+    for (uint32_t v = 0; v < in.num_vars; v++) {
+        if (!occurs[v]) {
+            continue;
+        }
+        const uint32_t r = find(v);
+        auto it = comp_of_root.find(r);
+        if (it == comp_of_root.end()) {
+            it = comp_of_root.insert(std::make_pair(r, (uint32_t)comps.size())).first;
+            comps.push_back(Component());
+        }
+        comp_of[v] = it->second;
+        new_var[v] = comps[it->second].formula.num_vars++;
+    }
+
+    for (const auto& cl: clauses) {
+        vector<Lit> lits;
+        for (const Lit l: cl) {
+            lits.push_back(Lit(new_var[l.var()], l.sign()));
+        }
+        comps[comp_of[cl[0].var()]].formula.clauses.push_back(lits);
+    }
+    for (const auto& x: xors) {
+        vector<uint32_t> vars;
+        for (const uint32_t v: x.first) {
+            vars.push_back(new_var[v]);
+        }
+        comps[comp_of[x.first[0]]].formula.xors.push_back(std::make_pair(vars, x.second));
+    }
+
+    for (const uint32_t v: sampling_set) {
+        if (value[v] != l_Undef) {
+            continue;
+        }
+        if (!occurs[v]) {
+            free_sampling_vars++;
+            continue;
+        }
+        comps[comp_of[v]].sampling_set.push_back(new_var[v]);
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef COMPONENTS_H_
+#define COMPONENTS_H_
+
+#include <cstdint>
+#include <vector>
+#include "counter.h"
+
+//Part of the formula sharing no variable with the rest
+struct Component {
+    InputFormula formula; //variables renumbered from 0
+    std::vector<uint32_t> sampling_set; //renumbered too
+};
+
+//Splits the formula into variable-disjoint components after unit
+//propagation. The projected count of the formula is the product of the
+//projected counts of the components, times 2 for every sampling variable
+//left in no clause.
+class Components {
+public:
+    Components(const InputFormula& in, const std::vector<uint32_t>& sampling_set);
+
+    //Returns false if unit propagation found the formula UNSAT
+    bool split();
+
+    std::vector<Component> comps;
+    uint32_t free_sampling_vars = 0;
+
+private:
+    bool propagate();
+    uint32_t find(uint32_t v);
+    void join(uint32_t a, uint32_t b);
+
+    const InputFormula& in;
+    const std::vector<uint32_t>& sampling_set;
+    std::vector<CMSat::lbool> value;
+    std::vector<uint32_t> root; //union-find
+};
+
+#endif //COMPONENTS_H_
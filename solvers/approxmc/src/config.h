@@ -32,6 +32,7 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include "approxmc.h"
 
 struct Config {
     uint32_t start_iter = 0;
@@ -48,6 +49,26 @@ struct Config {
     std::vector<uint32_t> sampling_set;
     std::string logfilename = "";
     int cms_detach_xor = 1;
+    uint32_t num_threads = 1;
+    std::string checkpoint_file = "";
+    int resume = 0;
+    double max_wall_time = 0;
+    ApproxMC::ProgressCallback progress;
+    std::vector<CMSat::Lit> assumptions; //only count solutions satisfying these
+    int reuse_hashes = 0; //same hashes for measurement N in every count
+    int ind_support = 0; //find an independent support if none is given
+    uint64_t ind_support_confl = 5000; //per variable
+    std::string ind_support_cache = "";
+    int preprocess = 0; //reduce the formula outside the sampling set first
+    std::string preprocess_cache = "";
+    int components = 0; //count variable-disjoint parts separately
+    std::string result_cache = "";
+    int fast_hit = 0; //log-guided jumps in the hash search
+    int enum_engine = 0; //enumerate cells without banning clauses
+    uint64_t enum_confl = 0; //conflict budget of enum_engine per cell, 0 = none
+    uint64_t compact_lits = 1000000; //rebuild the solver after this many dead literals, 0 = never
+    uint32_t cube_threads = 1; //threads to count the cubes of a cell on
+    uint32_t cube_vars = 0; //cells are split into 2^cube_vars cubes, 0 = by threads
 };
 
 #endif //APPMCCONFIG
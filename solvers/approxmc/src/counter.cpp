@@ -43,10 +43,15 @@
 #include <array>
 #include <cmath>
 #include <complex>
+#include <limits>
+#include <thread>
+#include <exception>
 //#include <coz.h>
 
 #include "counter.h"
+#include "components.h"
 #include "time_mem.h"
+#include "tmpname.h"
 #include "cryptominisat5/cryptominisat.h"
 #include "cryptominisat5/solvertypesmini.h"
 #include "GitSHA1.h"
@@ -57,25 +62,50 @@ using std::endl;
 using std::list;
 using std::map;
 
+//Adds the CPU and wall-clock time of its scope to a phase
+struct PhaseTimer {
+    explicit PhaseTimer(ApproxMC::PhaseTime& _phase) :
+        phase(_phase),
+        start_cpu(cpuTime()),
+        start_wall(wallTime())
+    {}
+
+    ~PhaseTimer()
+    {
+        phase.cpu += cpuTime() - start_cpu;
+        phase.wall += wallTime() - start_wall;
+    }
+
+    ApproxMC::PhaseTime& phase;
+    const double start_cpu;
+    const double start_wall;
+};
+
 Hash Counter::add_hash(uint32_t hash_index, SparseData& sparse_data)
 {
-    const string randomBits =
+    PhaseTimer timer(stats.hash_add);
+    stats.xors_added++;
+    vector<uint32_t> idxs =
         gen_rnd_bits(conf.sampling_set.size(), hash_index, sparse_data);
 
     vector<uint32_t> vars;
-    for (uint32_t j = 0; j < conf.sampling_set.size(); j++) {
-        if (randomBits[j] == '1') {
-            vars.push_back(conf.sampling_set[j]);
-        }
+    vars.reserve(idxs.size()+1);
+    for (const uint32_t j: idxs) {
+        vars.push_back(conf.sampling_set[j]);
     }
 
     solver->new_var();
     const uint32_t act_var = solver->nVars()-1;
     const bool rhs = gen_rhs();
-    Hash h(act_var, vars, rhs);
+    Hash h(act_var, vars, idxs, rhs);
+    h.row.resize((conf.sampling_set.size()+63)/64, 0);
+    for (const uint32_t idx: idxs) {
+        h.row[idx/64] |= 1ULL << (idx%64);
+    }
 
     vars.push_back(act_var);
     solver->add_xor_clause(vars, rhs);
+    retired_lits += vars.size();
     if (conf.verb_cls) {
         print_xor(vars, rhs);
     }
@@ -83,58 +113,110 @@ Hash Counter::add_hash(uint32_t hash_index, SparseData& sparse_data)
     return h;
 }
 
-void Counter::ban_one(const uint32_t act_var, const vector<lbool>& model)
+void Counter::ban_one(const uint32_t act_var, const SavedModels& models, const size_t at)
 {
     vector<Lit> lits;
     lits.push_back(Lit(act_var, false));
-    for (const uint32_t var: conf.sampling_set) {
-        lits.push_back(Lit(var, model[var] == l_True));
+    for (uint32_t i = 0; i < conf.sampling_set.size(); i++) {
+        lits.push_back(Lit(conf.sampling_set[i], models.value(at, i)));
     }
     solver->add_clause(lits);
+    retired_lits += lits.size();
 }
 
 ///adding banning clauses for repeating solutions
 uint64_t Counter::add_glob_banning_cls(
     const HashesModels* hm
     , const uint32_t act_var
-    , const uint32_t num_hashes)
+    , const uint32_t num_hashes
+    , vector<size_t>* banned)
 {
     if (hm == NULL)
         return 0;
+    PhaseTimer timer(stats.ban_add);
 
     assert(act_var != std::numeric_limits<uint32_t>::max());
     assert(num_hashes != std::numeric_limits<uint32_t>::max());
 
+    //Only has to match hashes below current need
+    //note that hashes are numbered from 0, so this is a "<" not "<="
+    vector<const Hash*> to_check;
+    for(uint32_t i = 0; i < num_hashes && i < hm->hashes.size(); i++) {
+        to_check.push_back(&hm->hashes[i]);
+    }
+
+    //Models are checked a group at a time, see SavedModels
+    const SavedModels& models = hm->glob_model;
+    const uint32_t W = SavedModels::slice_words;
     uint64_t repeat = 0;
-    vector<Lit> lits;
-    for (uint32_t i = 0; i < hm->glob_model.size(); i++) {
-        const SavedModel& sm = hm->glob_model[i];
-        //Model was generated with 'sm.hash_num' active
+    for (size_t g = 0; g < models.num_groups(); g++) {
+        const size_t first = g*SavedModels::slice_models;
+        const size_t last = first + SavedModels::slice_models;
+
+        //Model was generated with 'hash_num' active
         //We will have 'num_hashes' hashes active
+        //If it had at least as many, it fits for sure
+        uint64_t fits[W] = {0};
+        uint64_t unsure[W] = {0};
+        bool any_unsure = false;
+        for (size_t i = first; i < last; i++) {
+            const uint32_t k = (i - first)/64;
+            const uint64_t bit = 1ULL << ((i - first)%64);
+            if (models.hash_num(i) >= num_hashes) {
+                fits[k] |= bit;
+            } else {
+                unsure[k] |= bit;
+                any_unsure = true;
+            }
+        }
 
-        if (sm.hash_num >= num_hashes) {
-            ban_one(act_var, sm.model);
-            repeat++;
-        } else {
-            //Model has to fit all hashes
-            bool ok = true;
-            uint32_t checked = 0;
-            for(const auto& h: hm->hashes) {
-                //This hash is number: h.first
-                //Only has to match hashes below current need
-                //note that "h.first" is numbered from 0, so this is a "<" not "<="
-                if (h.first < num_hashes) {
-                    checked++;
-                    ok &= check_model_against_hash(h.second, sm.model);
-                    if (!ok) break;
+        //Others have to fit all hashes
+        for (const Hash* h: to_check) {
+            if (!any_unsure) {
+                break;
+            }
+            uint64_t acc[W];
+            models.group_parity(g, h->hash_idxs, acc);
+            const uint64_t rhs = h->rhs ? ~0ULL : 0ULL;
+            any_unsure = false;
+            for (uint32_t k = 0; k < W; k++) {
+                unsure[k] &= ~(acc[k] ^ rhs);
+                any_unsure |= unsure[k] != 0;
+            }
+        }
+
+        for (uint32_t k = 0; k < W; k++) {
+            const uint64_t ban = fits[k] | unsure[k];
+            for (uint32_t b = 0; ban != 0 && b < 64; b++) {
+                if ((ban >> b) & 1ULL) {
+                    ban_one(act_var, models, first + k*64 + b);
+                    if (banned) {
+                        banned->push_back(first + k*64 + b);
+                    }
+                    repeat++;
                 }
             }
-            if (ok) {
-                //cout << "Found repeat model, had to check " << checked << " hashes" << endl;
-                ban_one(act_var, sm.model);
-                repeat++;
+        }
+    }
+
+    //Models past the last full group, one at a time
+    for (size_t i = models.num_groups()*SavedModels::slice_models; i < models.size(); i++) {
+        bool fits = true;
+        if (models.hash_num(i) < num_hashes) {
+            for (const Hash* h: to_check) {
+                if (!check_model_against_hash(*h, models, i)) {
+                    fits = false;
+                    break;
+                }
             }
         }
+        if (fits) {
+            ban_one(act_var, models, i);
+            if (banned) {
+                banned->push_back(i);
+            }
+            repeat++;
+        }
     }
     return repeat;
 }
@@ -143,6 +225,7 @@ SolNum Counter::bounded_sol_count(
         uint32_t maxSolutions,
         const vector<Lit>* assumps,
         const uint32_t hashCount,
+        const int iter,
         HashesModels* hm
 ) {
     if (conf.verb) {
@@ -164,10 +247,15 @@ SolNum Counter::bounded_sol_count(
     } else {
         assert(hashCount == 0);
     }
+    new_assumps.insert(new_assumps.end(), conf.assumptions.begin(), conf.assumptions.end());
     solver->new_var();
     const uint32_t sol_ban_var = solver->nVars()-1;
     new_assumps.push_back(Lit(sol_ban_var, true));
 
+    const double start_wall = wallTime();
+    const uint64_t start_confl = solver->get_sum_conflicts();
+    const uint64_t start_props = solver->get_sum_propagations();
+    double simp_time = 0;
     if (conf.simplify >= 2) {
         if (conf.verb >= 2) {
             cout << "c [appmc] inter-simplifying" << endl;
@@ -175,7 +263,8 @@ SolNum Counter::bounded_sol_count(
         double myTime = cpuTime();
         solver->simplify(&new_assumps);
         solver->set_verbosity(0);
-        total_inter_simp_time += cpuTime() - myTime;
+        simp_time = cpuTime() - myTime;
+        total_inter_simp_time += simp_time;
         if (conf.verb >= 1) {
             cout << "c [appmc] inter-simp finished, total simp time: "
             << total_inter_simp_time << endl;
@@ -183,13 +272,43 @@ SolNum Counter::bounded_sol_count(
 
     }
 
-    const uint64_t repeat = add_glob_banning_cls(hm, sol_ban_var, hashCount);
+    const bool cubes = conf.cube_threads > 1
+        && conf.sampling_set.size() > conf.cube_vars;
+    vector<size_t> repeated;
+    const uint64_t repeat = add_glob_banning_cls(
+        hm, sol_ban_var, hashCount, cubes ? &repeated : NULL);
     uint64_t solutions = repeat;
+    bool stopped = false;
+    stats.cells++;
+    bool enumerated = false;
+    if (cubes) {
+        stopped = !count_cell_cubes(maxSolutions, hashCount, hm, repeated, solutions);
+        enumerated = true;
+    } else if (conf.enum_engine) {
+        const EnumEnd end = enumerate_cubes(
+            maxSolutions, new_assumps, sol_ban_var, hashCount, hm, solutions);
+        stopped = end == EnumEnd::stopped;
+        enumerated = end == EnumEnd::done;
+    }
     double last_found_time = cpuTimeTotal();
-    vector<vector<lbool>> models;
-    while (solutions < maxSolutions) {
-        lbool ret = solver->solve(&new_assumps);
+    while (!stopped && !enumerated && solutions < maxSolutions) {
+        if (must_stop()) {
+            stopped = true;
+            break;
+        }
+        lbool ret;
+        {
+            PhaseTimer timer(stats.sat);
+            ret = solver->solve(&new_assumps);
+        }
+        stats.sat_calls++;
         //COZ_PROGRESS_NAMED("one solution")
+        if (ret == l_Undef) {
+            //Interrupted because the time budget ran out, or by interrupt()
+            assert(must_stop());
+            stopped = true;
+            break;
+        }
         assert(ret == l_False || ret == l_True);
 
         if (conf.verb >= 2) {
@@ -219,44 +338,344 @@ SolNum Counter::bounded_sol_count(
 
         //Add solution to set
         solutions++;
-        const vector<lbool> model = solver->get_model();
+        const vector<lbool>& model = solver->get_model();
         //#ifdef SLOW_DEBUG
         check_model(model, hm, hashCount);
         //#endif
-        models.push_back(model);
+
+        //Save global models. Banning clauses for them were already added
+        //above, so they can go straight into the table
+        if (hm && conf.reuse_models) {
+            hm->glob_model.add(hashCount, model, conf.sampling_set);
+        }
 
         //ban solution
         vector<Lit> lits;
         lits.push_back(Lit(sol_ban_var, false));
         for (const uint32_t var: conf.sampling_set) {
-            assert(solver->get_model()[var] != l_Undef);
-            lits.push_back(Lit(var, solver->get_model()[var] == l_True));
+            assert(model[var] != l_Undef);
+            lits.push_back(Lit(var, model[var] == l_True));
         }
         if (conf.verb_cls) {
             cout << "c [appmc] Adding banning clause: " << lits << endl;
         }
         solver->add_clause(lits);
+        retired_lits += lits.size();
     }
 
 
-    //Save global models
-    if (hm && conf.reuse_models) {
-        for (const auto& model: models) {
-            hm->glob_model.push_back(SavedModel(hashCount, model));
-        }
-    }
-
     //Remove solution banning
     vector<Lit> cl_that_removes;
     cl_that_removes.push_back(Lit(sol_ban_var, false));
     solver->add_clause(cl_that_removes);
 
-    return SolNum(solutions, repeat);
+    LogEvent ev("count");
+    ev.iter = iter;
+    ev.hashes = hashCount;
+    ev.sols = std::min<uint64_t>(solutions, maxSolutions);
+    ev.full = solutions >= maxSolutions;
+    ev.repeat = repeat;
+    ev.conflicts = solver->get_sum_conflicts() - start_confl;
+    ev.propagations = solver->get_sum_propagations() - start_props;
+    if (hm) {
+        uint64_t xor_vars = 0;
+        for (uint32_t i = 0; i < hashCount; i++) {
+            xor_vars += hm->hashes[i].hash_vars.size();
+        }
+        ev.xor_vars = xor_vars;
+        ev.xor_len = hashCount == 0 ? 0 : (double)xor_vars/hashCount;
+    }
+    ev.time = wallTime() - start_wall;
+    ev.simp_time = simp_time;
+    log_event(ev);
+
+    if (!cubes) {
+        stats.solutions += solutions - repeat;
+    }
+    stats.repeated += repeat;
+
+    SolNum ret(solutions, repeat);
+    ret.stopped = stopped;
+    return ret;
+}
+
+//What the threads counting the cubes of one cell share
+struct CubeWork {
+    const InputFormula* in;
+    vector<std::pair<vector<uint32_t>, bool>> xors; //the active hashes
+    vector<vector<Lit>> bans; //models already counted as repeats
+    vector<uint32_t> split_vars;
+    uint64_t target; //solutions still to be found
+    std::atomic<uint64_t> next_cube{0};
+    std::atomic<uint64_t> found{0};
+    std::atomic<bool> stopped{false};
+    std::mutex models_mutex;
+    vector<vector<lbool>> models; //the first 'target' ones found
+};
+
+//Splits the cell on the first cube_vars variables of the sampling set and
+//enumerates the cubes on cube_threads threads, each with its own solver
+//built from the input formula and the active hashes. All stop as soon as
+//they found maxSolutions between them. CryptoMiniSat solvers cannot be
+//cloned, so the learnt clauses of the main solver are not shared with
+//them. Returns false if counting was stopped.
+bool Counter::count_cell_cubes(
+    const uint64_t maxSolutions,
+    const uint32_t hashCount,
+    HashesModels* hm,
+    const vector<size_t>& repeated,
+    uint64_t& solutions)
+{
+    if (solutions >= maxSolutions) {
+        return true;
+    }
+
+    CubeWork work;
+    work.in = parent ? &parent->input : &input;
+    for (uint32_t i = 0; i < hashCount; i++) {
+        work.xors.push_back(std::make_pair(hm->hashes[i].hash_vars, hm->hashes[i].rhs));
+    }
+    for (const size_t at: repeated) {
+        vector<Lit> ban;
+        for (uint32_t i = 0; i < conf.sampling_set.size(); i++) {
+            ban.push_back(Lit(conf.sampling_set[i], hm->glob_model.value(at, i)));
+        }
+        work.bans.push_back(ban);
+    }
+    const uint32_t k = conf.cube_vars > 0 ? conf.cube_vars
+        : (uint32_t)std::ceil(std::log2((double)conf.cube_threads)) + 2;
+    for (uint32_t i = 0; i < k && i < conf.sampling_set.size(); i++) {
+        work.split_vars.push_back(conf.sampling_set[i]);
+    }
+    work.target = maxSolutions - solutions;
+
+    vector<std::thread> threads;
+    for (uint32_t i = 0; i < conf.cube_threads; i++) {
+        threads.push_back(std::thread(&Counter::cube_worker, this, &work));
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+
+    for (const auto& model: work.models) {
+        check_model(model, hm, hashCount);
+        if (hm && conf.reuse_models) {
+            hm->glob_model.add(hashCount, model, conf.sampling_set);
+        }
+    }
+    solutions += std::min<uint64_t>(work.found, work.target);
+    if (conf.verb >= 2) {
+        cout << "c [appmc] cubes: " << (1ULL << work.split_vars.size())
+        << " on " << conf.cube_threads << " threads, found "
+        << solutions << " solutions" << endl;
+    }
+    return !work.stopped;
+}
+
+void Counter::cube_worker(CubeWork* work)
+{
+    Counter* registry = parent ? parent : this;
+    SATSolver* s = new_solver_from_input(*work->in);
+    registry->register_solver(s);
+    for (const auto& x: work->xors) {
+        s->add_xor_clause(x.first, x.second);
+    }
+    for (const auto& ban: work->bans) {
+        s->add_clause(ban);
+    }
+
+    ApproxMC::Stats local;
+    const uint64_t num_cubes = 1ULL << work->split_vars.size();
+    vector<Lit> assumps;
+    vector<Lit> ban;
+    while (work->found < work->target && !work->stopped) {
+        const uint64_t cube = work->next_cube++;
+        if (cube >= num_cubes) {
+            break;
+        }
+        assumps = conf.assumptions;
+        for (size_t i = 0; i < work->split_vars.size(); i++) {
+            assumps.push_back(Lit(work->split_vars[i], !((cube >> i) & 1)));
+        }
+
+        while (work->found < work->target) {
+            if (must_stop()) {
+                work->stopped = true;
+                break;
+            }
+            lbool ret;
+            {
+                PhaseTimer timer(local.sat);
+                ret = s->solve(&assumps);
+            }
+            local.sat_calls++;
+            if (ret == l_Undef) {
+                work->stopped = true;
+                break;
+            }
+            if (ret == l_False) {
+                break;
+            }
+
+            const vector<lbool>& model = s->get_model();
+            if (++work->found <= work->target) {
+                local.solutions++;
+                std::lock_guard<std::mutex> lock(work->models_mutex);
+                work->models.push_back(model);
+            }
+            ban.clear();
+            for (const uint32_t var: conf.sampling_set) {
+                ban.push_back(Lit(var, model[var] == l_True));
+            }
+            s->add_clause(ban);
+        }
+    }
+
+    registry->unregister_solver(s);
+    delete s;
+    add_stats(local);
+}
+
+//Enumerates the solutions of the cell projected on the sampling set without
+//banning clauses. After a model, its sampling set values are assumed in
+//order, and the last one not yet flipped is flipped, so every solve()
+//searches a cube disjoint from all earlier ones. When a cube is UNSAT, the
+//final conflict tells which of the assumed values it depends on, and the
+//deeper ones are dropped at once. If the per-cell conflict budget runs
+//out, the models found are banned by clauses as usual and the caller
+//carries on from there.
+EnumEnd Counter::enumerate_cubes(
+    const uint64_t maxSolutions,
+    const vector<Lit>& cell_assumps,
+    const uint32_t sol_ban_var,
+    const uint32_t hashCount,
+    HashesModels* hm,
+    uint64_t& solutions)
+{
+    struct Decision {
+        Lit lit;
+        bool flipped;
+    };
+    vector<Decision> trail;
+    vector<uint32_t> trail_at(solver->nVars(), std::numeric_limits<uint32_t>::max());
+    vector<vector<Lit>> found; //banning clauses, only added if out of budget
+    vector<Lit> assumps;
+    const uint64_t start_confl = solver->get_sum_conflicts();
+
+    //Drops the trail down to the last decision not yet flipped, and flips
+    //it. Returns false if there is none, i.e. the cell is done
+    auto backtrack = [&](size_t keep) {
+        trail.resize(keep);
+        while (!trail.empty() && trail.back().flipped) {
+            trail_at[trail.back().lit.var()] = std::numeric_limits<uint32_t>::max();
+            trail.pop_back();
+        }
+        if (trail.empty()) {
+            return false;
+        }
+        trail.back().lit = ~trail.back().lit;
+        trail.back().flipped = true;
+        return true;
+    };
+
+    EnumEnd end = EnumEnd::done;
+    while (solutions < maxSolutions) {
+        if (must_stop()) {
+            end = EnumEnd::stopped;
+            break;
+        }
+        if (conf.enum_confl > 0) {
+            const uint64_t used = solver->get_sum_conflicts() - start_confl;
+            if (used >= conf.enum_confl) {
+                end = EnumEnd::out_of_budget;
+                break;
+            }
+            solver->set_max_confl(conf.enum_confl - used);
+        }
+
+        assumps = cell_assumps;
+        for (const Decision& d: trail) {
+            assumps.push_back(d.lit);
+        }
+        lbool ret;
+        {
+            PhaseTimer timer(stats.sat);
+            ret = solver->solve(&assumps);
+        }
+        stats.sat_calls++;
+        if (ret == l_Undef) {
+            end = must_stop() ? EnumEnd::stopped : EnumEnd::out_of_budget;
+            break;
+        }
+
+        if (ret == l_True) {
+            solutions++;
+            const vector<lbool>& model = solver->get_model();
+            check_model(model, hm, hashCount);
+            if (hm && conf.reuse_models) {
+                hm->glob_model.add(hashCount, model, conf.sampling_set);
+            }
+            vector<Lit> ban;
+            ban.push_back(Lit(sol_ban_var, false));
+            for (const uint32_t var: conf.sampling_set) {
+                assert(model[var] != l_Undef);
+                ban.push_back(Lit(var, model[var] == l_True));
+                if (trail_at[var] == std::numeric_limits<uint32_t>::max()) {
+                    trail_at[var] = trail.size();
+                    trail.push_back(Decision{Lit(var, model[var] == l_False), false});
+                }
+            }
+            if (conf.enum_confl > 0) {
+                found.push_back(ban);
+            }
+            if (!backtrack(trail.size())) {
+                break;
+            }
+            continue;
+        }
+
+        //The cube is UNSAT because of the deepest trail literal in the
+        //conflict, or of the cell itself if there is none
+        size_t deepest = 0;
+        bool any = false;
+        for (const Lit l: solver->get_conflict()) {
+            const uint32_t at = l.var() < trail_at.size()
+                ? trail_at[l.var()] : std::numeric_limits<uint32_t>::max();
+            if (at != std::numeric_limits<uint32_t>::max()) {
+                deepest = any ? std::max<size_t>(deepest, at) : at;
+                any = true;
+            }
+        }
+        if (!any) {
+            break;
+        }
+        for (size_t i = deepest+1; i < trail.size(); i++) {
+            trail_at[trail[i].lit.var()] = std::numeric_limits<uint32_t>::max();
+        }
+        if (!backtrack(deepest+1)) {
+            break;
+        }
+    }
+    if (conf.enum_confl > 0) {
+        solver->set_max_confl(std::numeric_limits<uint64_t>::max());
+    }
+
+    if (end == EnumEnd::out_of_budget) {
+        if (conf.verb >= 2) {
+            cout << "c [appmc] enumeration out of its conflict budget after "
+            << solutions << " solutions, banning them" << endl;
+        }
+        for (const auto& ban: found) {
+            solver->add_clause(ban);
+            retired_lits += ban.size();
+        }
+    }
+    return end;
 }
 
 void Counter::print_final_count_stats(ApproxMC::SolCount solCount)
 {
-    if (solCount.hashCount == 0 && solCount.cellSolCount == 0) {
+    if (solCount.valid && solCount.hashCount == 0 && solCount.cellSolCount == 0) {
         cout << "c [appmc] Formula was UNSAT " << endl;
     }
 
@@ -265,43 +684,403 @@ void Counter::print_final_count_stats(ApproxMC::SolCount solCount)
     }
 }
 
+void Counter::stop_deadline_thread(std::thread& deadline_thread)
+{
+    if (!deadline_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        counting_done = true;
+    }
+    deadline_cond.notify_all();
+    deadline_thread.join();
+}
+
 ApproxMC::SolCount Counter::solve(Config _conf)
 {
     conf = _conf;
-    orig_num_vars = solver->nVars();
+    orig_num_vars = input.num_vars;
     startTime = cpuTimeTotal();
+    startWallTime = wallTime();
 
     openLogFile();
     randomEngine.seed(conf.seed);
 
-    ApproxMC::SolCount solCount = count();
+    counting_done = false;
+    std::thread deadline_thread;
+    if (conf.max_wall_time > 0) {
+        deadline_thread = std::thread(&Counter::watch_deadline, this);
+    }
+
+    ApproxMC::SolCount solCount;
+    try {
+        if (!count_by_components(solCount)) {
+            solCount = count();
+        }
+    } catch (...) {
+        stop_deadline_thread(deadline_thread);
+        event_log.close();
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        stop_asap = false;
+        throw;
+    }
+    stop_deadline_thread(deadline_thread);
     print_final_count_stats(solCount);
+    event_log.close();
+    num_counts++;
+
+    //interrupt() only stops the count it was called during, or the next
+    {
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        was_stopped = stop_asap;
+        stop_asap = false;
+    }
+    stats.total.cpu += cpuTimeTotal() - startTime;
+    stats.total.wall += wallTime() - startWallTime;
+    sample_rss();
 
     if (conf.verb) {
         cout << "c [appmc] FINISHED ApproxMC T: "
         << (cpuTimeTotal() - startTime) << " s"
         << endl;
-        if (solCount.hashCount == 0 && solCount.cellSolCount == 0) {
+        if (solCount.valid && solCount.hashCount == 0 && solCount.cellSolCount == 0) {
             cout << "c [appmc] Formula was UNSAT " << endl;
         }
     }
     return solCount;
 }
 
+//Marginals are counted one literal at a time. Every worker keeps its own
+//counter, so the solver is simplified once and the hashes of measurement N
+//are the same for all of its literals. The other workers' counters are
+//set up from the input formula, worker 0 counts on this one
+vector<ApproxMC::SolCount> Counter::count_marginals(
+    Config _conf, const vector<Lit>& lits)
+{
+    vector<ApproxMC::SolCount> counts(lits.size());
+    if (lits.empty()) {
+        return counts;
+    }
+    const uint32_t num_workers = std::min<size_t>(_conf.num_threads, lits.size());
+    Config mconf = _conf;
+    mconf.num_threads = 1;
+    mconf.reuse_hashes = 1;
+    mconf.max_wall_time = 0;
+    mconf.progress = ApproxMC::ProgressCallback();
+    mconf.checkpoint_file.clear();
+    mconf.resume = 0;
+    if (mconf.verb) {
+        cout << "c [appmc] Counting " << lits.size() << " marginals on "
+        << num_workers << " threads" << endl;
+    }
+
+    //The others' counters are quiet and do not log
+    Config wconf = mconf;
+    wconf.verb = 0;
+    wconf.logfilename.clear();
+    vector<Counter*> workers;
+    for (uint32_t i = 1; i < num_workers; i++) {
+        Counter* c = new Counter;
+        c->conf = wconf;
+        c->input = input;
+        c->orig_num_vars = input.num_vars;
+        c->solver = c->new_solver_from_input(input);
+        workers.push_back(c);
+    }
+    {
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        sub_stop = false;
+        sub_counters = workers;
+    }
+
+    vector<std::thread> threads;
+    for (uint32_t i = 1; i < num_workers; i++) {
+        threads.push_back(std::thread(
+            &Counter::marginals_worker, this
+            , workers[i-1], i, num_workers, wconf, &lits, &counts
+        ));
+    }
+    //Only this counter logs, so only it can fail. The others are stopped
+    //before the error is passed on
+    std::exception_ptr error;
+    try {
+        marginals_worker(this, 0, num_workers, mconf, &lits, &counts);
+    } catch (...) {
+        error = std::current_exception();
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        sub_stop = true;
+        for (Counter* c: workers) {
+            c->interrupt();
+        }
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        sub_counters.clear();
+    }
+    for (Counter* c: workers) {
+        add_stats(c->stats);
+        delete c->solver;
+        delete c;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return counts;
+}
+
+void Counter::marginals_worker(
+    Counter* c,
+    const uint32_t worker_id,
+    const uint32_t num_workers,
+    const Config& mconf,
+    const vector<Lit>* lits,
+    vector<ApproxMC::SolCount>* counts)
+{
+    for (size_t i = worker_id; i < lits->size(); i += num_workers) {
+        if (sub_stop) {
+            break;
+        }
+        Config lconf = mconf;
+        lconf.assumptions.push_back((*lits)[i]);
+        (*counts)[i] = c->solve(lconf);
+    }
+}
+
+//Count kept as mantissa*2^exponent, so products of many counts fit
+struct CountProduct {
+    long double mant = 1;
+    int64_t exp = 0;
+
+    void mul(const uint64_t cell, const uint32_t hash_count)
+    {
+        int e;
+        mant = std::frexp(mant*cell, &e);
+        exp += e + hash_count;
+    }
+
+    //cellSolCount is kept below 2^31, rounding if need be
+    ApproxMC::SolCount get() const
+    {
+        ApproxMC::SolCount ret;
+        ret.valid = true;
+        if (mant == 0) {
+            return ret;
+        }
+        if (exp <= 31) {
+            ret.cellSolCount = std::llround(std::ldexp(mant, exp));
+        } else {
+            ret.hashCount = exp - 31;
+            ret.cellSolCount = std::llround(std::ldexp(mant, 31));
+        }
+        return ret;
+    }
+};
+
+//Counts the variable-disjoint components of the formula one by one and
+//multiplies their counts. Components with few solutions are enumerated.
+//The k others each get ApproxMC with epsilon (1+eps)^(1/k)-1 and delta
+//delta/k, so the product is within a factor of 1+eps with probability at
+//least 1-delta. Returns false if the formula is better counted as a whole.
+bool Counter::count_by_components(ApproxMC::SolCount& sol_count)
+{
+    if (!conf.components
+        || parent
+        || !conf.assumptions.empty()
+        || conf.reuse_hashes
+        || !conf.checkpoint_file.empty()
+        || conf.max_wall_time > 0
+        || conf.start_iter != 0
+    ) {
+        return false;
+    }
+
+    Components split(input, conf.sampling_set);
+    if (!split.split()) {
+        if (conf.verb) {
+            cout << "c [appmc] Formula is UNSAT by unit propagation" << endl;
+        }
+        sol_count.clear();
+        sol_count.valid = true;
+        return true;
+    }
+    if (split.comps.size() == 1 && split.free_sampling_vars == 0) {
+        return false;
+    }
+
+    const uint64_t exact_limit = 128;
+    CountProduct prod;
+    prod.mul(1, split.free_sampling_vars);
+    vector<size_t> large;
+    for (size_t i = 0; i < split.comps.size(); i++) {
+        const uint64_t num = enumerate_component(split.comps[i], exact_limit);
+        if (num <= exact_limit) {
+            prod.mul(num, 0);
+        } else {
+            large.push_back(i);
+        }
+    }
+    if (conf.verb) {
+        cout << "c [appmc] Components: " << split.comps.size()
+        << " counted exactly: " << split.comps.size() - large.size()
+        << " free sampling vars: " << split.free_sampling_vars
+        << " to count approximately: " << large.size() << endl;
+    }
+
+    if (!large.empty() && prod.mant != 0) {
+        const double k = large.size();
+        Config cconf = conf;
+        cconf.epsilon = std::pow(1.0 + conf.epsilon, 1.0/k) - 1.0;
+        cconf.delta = conf.delta/k;
+        cconf.components = 0;
+        cconf.verb = 0;
+        cconf.logfilename.clear();
+        cconf.num_threads = large.size() == 1 ? conf.num_threads : 1;
+        if (conf.verb) {
+            cout << "c [appmc] Each of them with epsilon: " << cconf.epsilon
+            << " delta: " << cconf.delta << endl;
+        }
+
+        vector<ApproxMC::SolCount> counts(large.size());
+        std::atomic<size_t> next{0};
+        {
+            std::lock_guard<std::mutex> lock(deadline_mutex);
+            sub_stop = false;
+        }
+        const uint32_t num_workers = std::min<size_t>(conf.num_threads, large.size());
+        vector<std::thread> threads;
+        for (uint32_t i = 1; i < num_workers; i++) {
+            threads.push_back(std::thread(
+                &Counter::components_worker, this
+                , &split.comps, &large, &next, &cconf, &counts
+            ));
+        }
+        components_worker(&split.comps, &large, &next, &cconf, &counts);
+        for (auto& t: threads) {
+            t.join();
+        }
+
+        for (const ApproxMC::SolCount& c: counts) {
+            if (!c.valid || sub_stop) {
+                sol_count.clear();
+                return true;
+            }
+            prod.mul(c.cellSolCount, c.hashCount);
+        }
+    }
+
+    sol_count = prod.get();
+
+    //The product is reported as a single finished measurement
+    if (conf.progress) {
+        ApproxMC::Progress p;
+        p.measurements_done = 1;
+        p.measurements_total = 1;
+        p.estimate = sol_count;
+        p.confidence = 1.0 - conf.delta;
+        p.wall_time = wallTime() - startWallTime;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        conf.progress(p);
+    }
+    return true;
+}
+
+uint64_t Counter::enumerate_component(const Component& comp, const uint64_t limit)
+{
+    SATSolver s;
+    s.new_vars(comp.formula.num_vars);
+    for (const auto& cl: comp.formula.clauses) {
+        s.add_clause(cl);
+    }
+    for (const auto& x: comp.formula.xors) {
+        s.add_xor_clause(x.first, x.second);
+    }
+
+    uint64_t num = 0;
+    vector<Lit> ban;
+    while (num <= limit) {
+        lbool ret;
+        {
+            PhaseTimer timer(stats.sat);
+            ret = s.solve();
+        }
+        stats.sat_calls++;
+        if (ret != l_True) {
+            break;
+        }
+        num++;
+        stats.solutions++;
+        if (comp.sampling_set.empty()) {
+            break;
+        }
+        ban.clear();
+        for (const uint32_t v: comp.sampling_set) {
+            ban.push_back(Lit(v, s.get_model()[v] == l_True));
+        }
+        s.add_clause(ban);
+    }
+    return num;
+}
+
+void Counter::components_worker(
+    const vector<Component>* comps,
+    const vector<size_t>* large,
+    std::atomic<size_t>* next,
+    const Config* cconf,
+    vector<ApproxMC::SolCount>* counts)
+{
+    while (!sub_stop) {
+        const size_t at = (*next)++;
+        if (at >= large->size()) {
+            break;
+        }
+        const Component& comp = (*comps)[(*large)[at]];
+        Counter* c = new Counter;
+        c->conf = *cconf;
+        c->conf.sampling_set = comp.sampling_set;
+        c->input = comp.formula;
+        c->orig_num_vars = comp.formula.num_vars;
+        c->solver = c->new_solver_from_input(c->input);
+        {
+            std::lock_guard<std::mutex> lock(deadline_mutex);
+            sub_counters.push_back(c);
+            if (sub_stop) {
+                c->interrupt();
+            }
+        }
+
+        (*counts)[at] = c->solve(c->conf);
+
+        {
+            std::lock_guard<std::mutex> lock(deadline_mutex);
+            sub_counters.erase(
+                std::remove(sub_counters.begin(), sub_counters.end(), c),
+                sub_counters.end());
+        }
+        add_stats(c->stats);
+        delete c->solver;
+        delete c;
+    }
+}
+
 vector<Lit> Counter::set_num_hashes(
     uint32_t num_wanted,
-    map<uint64_t, Hash>& hashes,
+    vector<Hash>& hashes,
     SparseData& sparse_data
 ) {
     vector<Lit> assumps;
+    assumps.reserve(num_wanted);
     for(uint32_t i = 0; i < num_wanted; i++) {
-        if (hashes.find(i) != hashes.end()) {
-            assumps.push_back(Lit(hashes[i].act_var, true));
-        } else {
-            Hash h = add_hash(i, sparse_data);
-            assumps.push_back(Lit(h.act_var, true));
-            hashes[i] = h;
+        if (i >= hashes.size()) {
+            //Hashes are always added in order
+            assert(i == hashes.size());
+            hashes.push_back(add_hash(i, sparse_data));
         }
+        assumps.push_back(Lit(hashes[i].act_var, true));
     }
     assert(num_wanted == assumps.size());
 
@@ -314,6 +1093,9 @@ void Counter::simplify()
         cout << "c [appmc] simplifying" << endl;
     }
 
+    PhaseTimer timer(stats.simplify);
+    const double start_wall = wallTime();
+    const uint64_t start_confl = solver->get_sum_conflicts();
     solver->set_sls(1);
     solver->set_intree_probe(1);
     solver->set_full_bve_iter_ratio(conf.var_elim_ratio);
@@ -322,7 +1104,7 @@ void Counter::simplify()
     solver->set_distill(1);
     solver->set_scc(1);
 
-    solver->simplify();
+    solver->simplify(&conf.assumptions);
 
     solver->set_sls(0);
     solver->set_intree_probe(0);
@@ -330,6 +1112,12 @@ void Counter::simplify()
     solver->set_bva(0);
     solver->set_distill(0);
     //solver->set_scc(0);
+
+    LogEvent ev("simplify");
+    ev.conflicts = solver->get_sum_conflicts() - start_confl;
+    ev.time = wallTime() - start_wall;
+    ev.simp_time = ev.time;
+    log_event(ev);
 }
 
 void Counter::set_up_probs_threshold_measurements(
@@ -380,33 +1168,58 @@ ApproxMC::SolCount Counter::count()
     SparseData sparse_data(-1);
     uint32_t measurements;
     set_up_probs_threshold_measurements(measurements, sparse_data);
-    
-    if (conf.verb) {
+
+    numHashList.clear();
+    numCountList.clear();
+    numIterList.clear();
+
+    Checkpoint cp;
+    const bool resumed = conf.resume && read_checkpoint(cp);
+    if (resumed) {
+        hashCount = cp.start_hash;
+        if (conf.verb) {
+            cout << "c [appmc] Resuming from checkpoint '" << conf.checkpoint_file
+            << "' with " << numHashList.size() << " measurements done" << endl;
+        }
+        if (conf.simplify >= 1 && !simplified) {
+            simplify();
+            simplified = true;
+        }
+    }
+
+    if (conf.verb && !resumed) {
         cout << "c [appmc] Starting up, initial measurement" << endl;
     }
     if (hashCount == 0) {
         if (conf.verb) {
             cout << "c [appmc] Checking if there are at least threshold+1 solutions..." << endl;
         }
-        double myTime = cpuTime();
-        if (conf.simplify >= 1) {
-            simplify();
+        SolNum init_sols(0, 0);
+        {
+            PhaseTimer timer(stats.initial_check);
+            if (conf.simplify >= 1 && !simplified) {
+                simplify();
+                simplified = true;
+            }
+            init_sols = bounded_sol_count(
+                threshold+1, //max solutions
+                NULL, // no assumptions
+                hashCount,
+                0 //iteration
+            );
+        }
+        if (init_sols.stopped) {
+            if (conf.verb) {
+                cout << "c [appmc] Counting stopped during the initial check" << endl;
+            }
+            return ApproxMC::SolCount();
         }
-        int64_t init_num_sols = bounded_sol_count(
-            threshold+1, //max solutions
-            NULL, // no assumptions
-            hashCount
-        ).solutions;
+        int64_t init_num_sols = init_sols.solutions;
 
         if (conf.verb >= 2) {
             cout << "c [appmc] Initial number of solutions: " << init_num_sols << endl;
         }
 
-        write_log(false, //not sampling
-                  0, 0,
-                  init_num_sols == (threshold + 1),
-                  init_num_sols, 0, cpuTime() - myTime);
-
         //Din't find at least threshold+1
         if (init_num_sols <= threshold) {
             if (conf.verb) {
@@ -426,54 +1239,530 @@ ApproxMC::SolCount Counter::count()
     if (conf.verb) {
         cout << "c [appmc] Starting at hash count: " << hashCount << endl;
     }
-    int64_t mPrev = hashCount;
+    start_hash = hashCount;
+    measurements_total = measurements;
+    int64_t mPrev = resumed ? cp.mPrev : hashCount;
+    if (!resumed) {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        save_rng_state();
+        write_checkpoint();
+    }
 
-    numHashList.clear();
-    numCountList.clear();
+    vector<char> done(measurements, 0);
+    for (const uint32_t j: numIterList) {
+        if (j < measurements) {
+            done[j] = 1;
+        }
+    }
 
     //See Algorithm 1 in paper "Algorithmic Improvements in Approximate Counting
     //for Probabilistic Inference: From Linear to Logarithmic SAT Calls"
     //https://www.ijcai.org/Proceedings/16/Papers/503.pdf
-    for (uint32_t j = 0; j < measurements; j++) {
-        one_measurement_count(
-            mPrev
-            , j
-            , sparse_data
-        );
-        sparse_data.next_index = 0;
+    if (conf.num_threads > 1 && measurements > 1) {
+        parallel_measurements(measurements, mPrev, sparse_data, done);
+    } else {
+        bool first = true;
+        for (uint32_t j = 0; j < measurements; j++) {
+            if (done[j]) {
+                continue;
+            }
+            if (must_stop()) {
+                break;
+            }
 
-        //Only simplify before next round
-        if (conf.simplify >= 1 && j+1 < measurements) {
-            simplify();
+            //Only simplify before next round
+            if (!first) {
+                compact_solver();
+            }
+            if (conf.simplify >= 1 && !first) {
+                simplify();
+            }
+            first = false;
+
+            one_measurement_count(
+                mPrev
+                , j
+                , sparse_data
+            );
+            sparse_data.next_index = 0;
+        }
+    }
+    if (must_stop()) {
+        if (conf.verb) {
+            cout << "c [appmc] Counting stopped after " << numHashList.size()
+            << " of " << measurements << " measurements" << endl;
         }
+        return calc_est_count();
     }
     assert(numHashList.size() > 0 && "UNSAT should not be possible");
 
     return calc_est_count();
 }
 
+//Measurements are independent apart from mPrev, which only decides where
+//the search starts. Every worker gets its own solver built from the input
+//formula and does every num_threads-th measurement.
+void Counter::parallel_measurements(
+    const uint32_t measurements,
+    const int64_t mPrev,
+    const SparseData& sparse_data,
+    const vector<char>& done)
+{
+    const uint32_t num_workers = std::min<uint32_t>(conf.num_threads, measurements);
+    if (conf.verb) {
+        cout << "c [appmc] Doing " << measurements << " measurements on "
+        << num_workers << " threads" << endl;
+    }
+
+    vector<std::thread> threads;
+    for (uint32_t i = 0; i < num_workers; i++) {
+        threads.push_back(std::thread(
+            &Counter::worker_measurements, this
+            , i, num_workers, measurements, mPrev, sparse_data, &done
+        ));
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+}
+
+void Counter::worker_measurements(
+    const uint32_t worker_id,
+    const uint32_t num_workers,
+    const uint32_t measurements,
+    int64_t mPrev,
+    SparseData sparse_data,
+    const vector<char>* done)
+{
+    Counter worker;
+    worker.conf = conf;
+    worker.parent = this;
+    worker.startTime = startTime;
+    worker.threshold = threshold;
+    worker.orig_num_vars = orig_num_vars;
+    worker.solver = worker.new_solver_from_input(input);
+    register_solver(worker.solver);
+
+    for (uint32_t j = worker_id; j < measurements; j += num_workers) {
+        if ((*done)[j]) {
+            continue;
+        }
+        if (must_stop()) {
+            break;
+        }
+        worker.compact_solver();
+        if (conf.simplify >= 1) {
+            worker.simplify();
+        }
+        worker.one_measurement_count(mPrev, j, sparse_data);
+        sparse_data.next_index = 0;
+    }
+
+    unregister_solver(worker.solver);
+    delete worker.solver;
+    worker.solver = NULL;
+    add_stats(worker.stats);
+}
+
+//Hashes and banning clauses are only switched off by a unit clause on their
+//activation variable once they are not needed, the solver cannot drop
+//them or the variables. Once they make up more than the formula itself,
+//the solver is built again from the input formula between two
+//measurements. What it learnt is lost, so this is not done too often.
+void Counter::compact_solver()
+{
+    if (!conf.compact_lits || solver_shared || conf.reuse_hashes) {
+        return;
+    }
+
+    //Workers of parallel measurements share their parent's copy
+    const InputFormula& in = parent ? parent->input : input;
+    uint64_t input_lits = 0;
+    for (const auto& cl: in.clauses) {
+        input_lits += cl.size();
+    }
+    for (const auto& x: in.xors) {
+        input_lits += x.first.size();
+    }
+    if (retired_lits < std::max<uint64_t>(conf.compact_lits, input_lits)) {
+        return;
+    }
+
+    if (conf.verb) {
+        cout << "c [appmc] Compacting the solver, dropping " << retired_lits
+        << " literals of old hashes and banning clauses and "
+        << solver->nVars() - orig_num_vars << " activation variables" << endl;
+    }
+    SATSolver* old = solver;
+    SATSolver* s = new_solver_from_input(in);
+    if (parent) {
+        parent->unregister_solver(old);
+        solver = s;
+        parent->register_solver(s);
+    } else {
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        solver = s;
+        if (stop_asap) {
+            s->interrupt_asap();
+        }
+    }
+    delete old;
+    retired_lits = 0;
+    stats.compactions++;
+}
+
+//Preprocessing hands in a smaller formula over the same variables, before
+//the first count
+void Counter::replace_input(const InputFormula& in, const Config& _conf)
+{
+    conf = _conf;
+    input = in;
+    orig_num_vars = input.num_vars;
+    SATSolver* old = solver;
+    SATSolver* s = new_solver_from_input(input);
+    {
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        solver = s;
+    }
+    delete old;
+    simplified = false;
+    retired_lits = 0;
+}
+
+SATSolver* Counter::new_solver_from_input(const InputFormula& in)
+{
+    SATSolver* s = new SATSolver();
+    s->set_up_for_scalmc();
+    s->set_allow_otf_gauss();
+    s->set_xor_detach(conf.cms_detach_xor);
+    if (conf.verb > 2) {
+        s->set_verbosity(conf.verb-2);
+    }
+
+    s->new_vars(orig_num_vars);
+    for (const auto& cl: in.clauses) {
+        s->add_clause(cl);
+    }
+    for (const auto& x: in.xors) {
+        s->add_xor_clause(x.first, x.second);
+    }
+    s->set_sampling_vars(&conf.sampling_set);
+
+    return s;
+}
+
+//Workers keep their own list, since their mPrev depends on it, and pass
+//every measurement on to the counter that started them
+void Counter::add_measurement(const uint32_t iter, const uint64_t hashCount, const int64_t num_sols)
+{
+    if (parent) {
+        numHashList.push_back(hashCount);
+        numCountList.push_back(num_sols);
+        numIterList.push_back(iter);
+        parent->add_measurement(iter, hashCount, num_sols);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        numHashList.push_back(hashCount);
+        numCountList.push_back(num_sols);
+        numIterList.push_back(iter);
+        save_rng_state();
+        write_checkpoint();
+        sample_rss();
+    }
+    report_progress();
+}
+
+//Called without result_mutex held, so the callback may ask for the
+//partial count itself
+void Counter::report_progress()
+{
+    if (!conf.progress) {
+        return;
+    }
+
+    ApproxMC::Progress p;
+    p.estimate = calc_partial_count(p.confidence);
+    {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        p.measurements_done = numHashList.size();
+    }
+    p.measurements_total = measurements_total;
+    p.wall_time = wallTime() - startWallTime;
+
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    conf.progress(p);
+}
+
+//The engine is only saved between measurements, so a checkpoint written
+//in the middle of one resumes with exactly the hashes it would have used
+void Counter::save_rng_state()
+{
+    std::ostringstream ss;
+    ss << randomEngine;
+    rng_state = ss.str();
+}
+
 ApproxMC::SolCount Counter::calc_est_count()
+{
+    return calc_est_count(numHashList, numCountList);
+}
+
+ApproxMC::SolCount Counter::calc_est_count(
+    vector<uint64_t> hashes, vector<int64_t> counts)
 {
     ApproxMC::SolCount ret_count;
-    if (numHashList.empty() || numCountList.empty()) {
+    if (hashes.empty() || counts.empty()) {
         return ret_count;
     }
 
-    const auto minHash = findMin(numHashList);
-    auto cnt_it = numCountList.begin();
-    for (auto hash_it = numHashList.begin()
-        ; hash_it != numHashList.end() && cnt_it != numCountList.end()
+    const auto minHash = findMin(hashes);
+    auto cnt_it = counts.begin();
+    for (auto hash_it = hashes.begin()
+        ; hash_it != hashes.end() && cnt_it != counts.end()
         ; hash_it++, cnt_it++
     ) {
         *cnt_it *= pow(2, (*hash_it) - minHash);
     }
     ret_count.valid = true;
-    ret_count.cellSolCount = findMedian(numCountList);
+    ret_count.cellSolCount = findMedian(counts);
     ret_count.hashCount = minHash;
 
     return ret_count;
 }
 
+//Estimate from the measurements done so far, and the confidence that
+//many measurements give. Can be called while counting.
+ApproxMC::SolCount Counter::calc_partial_count(double& confidence)
+{
+    vector<uint64_t> hashes;
+    vector<int64_t> counts;
+    {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        hashes = numHashList;
+        counts = numCountList;
+    }
+
+    confidence = 0;
+    if (!hashes.empty()) {
+        const size_t at = std::min<size_t>(
+            (hashes.size()-1)/2, constants.iterationConfidences.size()-1);
+        confidence = constants.iterationConfidences[at];
+    }
+    return calc_est_count(hashes, counts);
+}
+
+////////////////////////////
+// Anytime counting
+////////////////////////////
+
+bool Counter::must_stop() const
+{
+    if (parent) {
+        return parent->must_stop();
+    }
+    return stop_asap;
+}
+
+void Counter::watch_deadline()
+{
+    std::unique_lock<std::mutex> lock(deadline_mutex);
+    const auto budget = std::chrono::duration<double>(conf.max_wall_time);
+    if (deadline_cond.wait_for(lock, budget, [this]{ return counting_done; })) {
+        return;
+    }
+
+    stop_asap_locked();
+}
+
+//Stops counting as soon as possible, from any thread. Finished
+//measurements are kept, the one in progress is dropped
+void Counter::interrupt()
+{
+    std::lock_guard<std::mutex> lock(deadline_mutex);
+    sub_stop = true;
+    stop_asap_locked();
+    for (Counter* c: sub_counters) {
+        c->interrupt();
+    }
+}
+
+//Must be called with deadline_mutex held
+void Counter::stop_asap_locked()
+{
+    stop_asap = true;
+    if (solver) {
+        solver->interrupt_asap();
+    }
+    for (SATSolver* s: active_solvers) {
+        s->interrupt_asap();
+    }
+}
+
+//Solvers of worker threads, so they can be interrupted too
+void Counter::register_solver(SATSolver* s)
+{
+    std::lock_guard<std::mutex> lock(deadline_mutex);
+    active_solvers.push_back(s);
+    if (stop_asap) {
+        s->interrupt_asap();
+    }
+}
+
+void Counter::unregister_solver(SATSolver* s)
+{
+    std::lock_guard<std::mutex> lock(deadline_mutex);
+    active_solvers.erase(
+        std::remove(active_solvers.begin(), active_solvers.end(), s),
+        active_solvers.end());
+}
+
+////////////////////////////
+// Checkpointing
+////////////////////////////
+
+void Counter::save_checkpoint()
+{
+    std::lock_guard<std::mutex> lock(result_mutex);
+    write_checkpoint();
+}
+
+//Must be called with result_mutex held
+void Counter::write_checkpoint()
+{
+    if (conf.checkpoint_file.empty() || parent || rng_state.empty()) {
+        return;
+    }
+
+    const string tmp_name = tmp_file_name(conf.checkpoint_file);
+    std::ofstream f(tmp_name.c_str());
+    if (!f) {
+        cout << "c [appmc] WARNING: could not write checkpoint file '"
+        << tmp_name << "'" << endl;
+        return;
+    }
+
+    f << "c approxmc checkpoint" << endl
+    << "version 1" << endl
+    << std::setprecision(17)
+    << "seed " << conf.seed << endl
+    << "epsilon " << conf.epsilon << endl
+    << "delta " << conf.delta << endl
+    << "sparse " << conf.sparse << endl
+    << "sampling_set_size " << conf.sampling_set.size() << endl
+    << "num_vars " << orig_num_vars << endl
+    << "assumptions " << assumptions_str() << endl
+    << "start_hash " << start_hash << endl
+    << "mprev " << (numHashList.empty() ? start_hash : numHashList.back()) << endl
+    << "rng " << rng_state << endl;
+    for (size_t i = 0; i < numHashList.size(); i++) {
+        f << "measurement " << numIterList[i]
+        << " " << numHashList[i]
+        << " " << numCountList[i] << endl;
+    }
+    f.close();
+
+    if (!f || std::rename(tmp_name.c_str(), conf.checkpoint_file.c_str()) != 0) {
+        cout << "c [appmc] WARNING: could not write checkpoint file '"
+        << conf.checkpoint_file << "'" << endl;
+        std::remove(tmp_name.c_str());
+    }
+}
+
+//Assumptions as DIMACS literals, so a checkpoint is only resumed under
+//the same ones
+string Counter::assumptions_str() const
+{
+    std::stringstream ss;
+    for (const Lit l: conf.assumptions) {
+        ss << l << " ";
+    }
+    ss << "0";
+    return ss.str();
+}
+
+//Reads back the checkpoint, restoring the measurements and the random
+//engine. Returns false if there is no checkpoint to resume from.
+bool Counter::read_checkpoint(Checkpoint& cp)
+{
+    if (conf.checkpoint_file.empty()) {
+        throw ApproxMC::AppMCError("resuming needs a checkpoint file");
+    }
+
+    std::ifstream f(conf.checkpoint_file.c_str());
+    if (!f) {
+        if (conf.verb) {
+            cout << "c [appmc] No checkpoint at '" << conf.checkpoint_file
+            << "', starting from scratch" << endl;
+        }
+        return false;
+    }
+
+    uint32_t seed = 0;
+    double epsilon = 0;
+    double delta = 0;
+    int sparse = 0;
+    size_t sampl_size = 0;
+    uint32_t num_vars = 0;
+    string assumptions;
+    vector<uint32_t> iters;
+    vector<uint64_t> hashes;
+    vector<int64_t> counts;
+    bool have_rng = false;
+
+    string line;
+    while (std::getline(f, line)) {
+        std::istringstream ss(line);
+        string key;
+        ss >> key;
+        if (key == "seed") ss >> seed;
+        else if (key == "epsilon") ss >> epsilon;
+        else if (key == "delta") ss >> delta;
+        else if (key == "sparse") ss >> sparse;
+        else if (key == "sampling_set_size") ss >> sampl_size;
+        else if (key == "num_vars") ss >> num_vars;
+        else if (key == "assumptions") std::getline(ss >> std::ws, assumptions);
+        else if (key == "start_hash") ss >> cp.start_hash;
+        else if (key == "mprev") ss >> cp.mPrev;
+        else if (key == "rng") {
+            ss >> randomEngine;
+            have_rng = !ss.fail();
+            save_rng_state();
+        } else if (key == "measurement") {
+            uint32_t iter;
+            uint64_t hash;
+            int64_t cnt;
+            if (ss >> iter >> hash >> cnt) {
+                iters.push_back(iter);
+                hashes.push_back(hash);
+                counts.push_back(cnt);
+            }
+        }
+    }
+
+    if (seed != conf.seed
+        || epsilon != conf.epsilon
+        || delta != conf.delta
+        || sparse != conf.sparse
+        || sampl_size != conf.sampling_set.size()
+        || num_vars != orig_num_vars
+        || assumptions != assumptions_str()
+        || cp.start_hash == 0
+        || !have_rng
+    ) {
+        throw ApproxMC::AppMCError("checkpoint '" + conf.checkpoint_file
+            + "' does not match this CNF and these settings");
+    }
+
+    std::lock_guard<std::mutex> lock(result_mutex);
+    numIterList = iters;
+    numHashList = hashes;
+    numCountList = counts;
+    return true;
+}
+
 int Counter::find_best_sparse_match()
 {
     for(int i = 0; i < (int)constants.index_var_maps.size(); i++) {
@@ -505,26 +1794,77 @@ void Counter::one_measurement_count(
     SparseData sparse_data
 )
 {
-    //Tells the number of solutions found at hash number N
-    //sols_for_hash[N] tells the number of solutions found when N hashes were added
-    map<uint64_t,int64_t> sols_for_hash;
+    HashesModels hm;
+    if (conf.reuse_hashes) {
+        hm.hashes.swap(hash_cache[iter]);
+    }
 
-    //threshold_sols[hash_num]==1 tells us that at hash_num number of hashes
-    //there were found to be FULL threshold number of solutions
-    //threshold_sols[hash_num]==0 tells that there were less than threshold
-    //number of solutions.
-    //if it's not set, we have no clue.
-    map<uint64_t,bool> threshold_sols;
+    //The hashes of a measurement only depend on the seed and its index, not
+    //on how many hashes the measurements before it drew, so the count does
+    //not depend on the number of threads. Hashes added to reused ones get
+    //a stream of their own, not the one the reused ones came from
+    std::seed_seq seq{conf.seed, (uint32_t)iter, (uint32_t)hm.hashes.size()};
+    randomEngine.seed(seq);
+    galloping_search(mPrev, iter, sparse_data, hm);
+    if (conf.reuse_hashes) {
+        hm.hashes.swap(hash_cache[iter]);
+    }
+}
 
-    HashesModels hm;
+//Number of hashes the cell is expected to first drop below threshold+1
+//at, from the median of the log2 estimates of the measurements so far
+int64_t Counter::estimate_start_hash(const int64_t mPrev, const int64_t max_hashes)
+{
+    vector<double> est;
+    {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        for (size_t i = 0; i < numHashList.size(); i++) {
+            if (numCountList[i] > 0) {
+                est.push_back(numHashList[i] + std::log2((double)numCountList[i]));
+            }
+        }
+    }
+    if (est.empty()) {
+        return mPrev;
+    }
 
+    std::sort(est.begin(), est.end());
+    const double median = est[est.size()/2];
+    const int64_t m = std::floor(median - std::log2((double)threshold+1)) + 1;
+    return std::max<int64_t>(1, std::min(m, max_hashes));
+}
+
+void Counter::galloping_search(
+    int64_t& mPrev,
+    const int iter,
+    SparseData& sparse_data,
+    HashesModels& hm
+)
+{
     int64_t total_max_xors = conf.sampling_set.size();
+
+    //Tells the number of solutions found at hash number N, and whether
+    //at N hashes there were found to be FULL threshold number of solutions,
+    //less than threshold number of solutions, or if we have no clue.
+    MeasurementState state(total_max_xors);
+
+    //Measurements only start once the initial check found more than
+    //threshold solutions with no hashes, unless told to start elsewhere
+    if (conf.start_iter == 0) {
+        state.set(0, CellState::full, threshold+1);
+    }
+
     int64_t numExplored = 0;
     int64_t lowerFib = 0;
     int64_t upperFib = total_max_xors;
 
+    if (conf.fast_hit) {
+        mPrev = estimate_start_hash(mPrev, total_max_xors);
+    }
     int64_t hashCount = mPrev;
     int64_t hashPrev = hashCount;
+    const double start_wall = wallTime();
+    const uint64_t start_confl = solver->get_sum_conflicts();
     
     //We are doing a galloping search here (see our IJCAI-16 paper for more details). 
     //lowerFib is referred to as loIndex and upperFib is referred to as hiIndex
@@ -544,21 +1884,19 @@ void Counter::one_measurement_count(
             << " round: " << std::setw(2) << iter
             << " hashes: " << std::setw(6) << hashCount << endl;
         }
-        double myTime = cpuTime();
         SolNum sols = bounded_sol_count(
             threshold + 1, //max no. solutions
             &assumps, //assumptions to use
             hashCount,
+            iter,
             &hm
         );
+        if (sols.stopped) {
+            //Measurement is unfinished, it cannot be used
+            return;
+        }
         const uint64_t num_sols = std::min<uint64_t>(sols.solutions, threshold + 1);
         assert(num_sols <= threshold + 1);
-        bool found_full = (num_sols == threshold + 1);
-        write_log(
-            false, //not sampling
-            iter, hashCount, found_full, num_sols, sols.repeated,
-            cpuTime() - myTime
-        );
 
         if (num_sols < threshold + 1) {
             numExplored = lowerFib + total_max_xors - hashCount;
@@ -566,18 +1904,16 @@ void Counter::one_measurement_count(
             //one less hash count had threshold solutions
             //this one has less than threshold
             //so this is the real deal!
-            if (threshold_sols.find(hashCount-1) != threshold_sols.end()
-                && threshold_sols[hashCount-1] == 1
-            ) {
-                numHashList.push_back(hashCount);
-                numCountList.push_back(num_sols);
+            if (state.is(hashCount-1, CellState::full)) {
                 mPrev = hashCount;
+                log_measurement(iter, hashCount, num_sols, start_wall, start_confl);
+                add_measurement(iter, hashCount, num_sols);
                 return;
             }
 
-            threshold_sols[hashCount] = 0;
-            sols_for_hash[hashCount] = num_sols;
-            if (iter > 0 &&
+            state.set(hashCount, CellState::below_threshold, num_sols);
+            //mPrev only means something if we already have a measurement
+            if (!numHashList.empty() &&
                 std::abs(hashCount - mPrev) <= 2
             ) {
                 //Doing linear, this is a re-count
@@ -593,17 +1929,23 @@ void Counter::one_measurement_count(
                 }
 
                 //Fast hit
-                if (false) {
+                if (conf.fast_hit && num_sols > 0) {
                     //Trying to hit the right place in case
-                    //we got some solutions here -- calculate the right place
-                    int64_t diff_delta = 0;
-                    if (num_sols > 0) {
-                        diff_delta = log2(threshold/(num_sols));
-                        if (diff_delta == 0){
-                            diff_delta = 1;
-                        }
-                        hashCount -= diff_delta;
-                    } else {
+                    //we got some solutions here -- calculate the right place.
+                    //Every hash removed about doubles the cell, so the
+                    //threshold is crossed diff_delta hashes below.
+                    int64_t diff_delta = log2((double)threshold/num_sols);
+                    if (diff_delta == 0){
+                        diff_delta = 1;
+                    }
+                    hashCount -= diff_delta;
+
+                    //Must stay strictly above lowerFib, so the bracket
+                    //keeps shrinking, and must not be a count we know
+                    if (hashCount <= lowerFib
+                        || state.is(hashCount, CellState::full)
+                        || state.is(hashCount, CellState::below_threshold)
+                    ) {
                         hashCount = (upperFib+lowerFib)/2;
                     }
                 } else {
@@ -618,18 +1960,16 @@ void Counter::one_measurement_count(
             //success record for +1 hashcount exists and is 0
             //so one-above hashcount was below threshold, this is above
             //we have a winner -- the one above!
-            if (threshold_sols.find(hashCount+1) != threshold_sols.end()
-                && threshold_sols[hashCount+1] == 0
-            ) {
-                numHashList.push_back(hashCount+1);
-                numCountList.push_back(sols_for_hash[hashCount+1]);
+            if (state.is(hashCount+1, CellState::below_threshold)) {
                 mPrev = hashCount+1;
+                log_measurement(iter, hashCount+1, state.sols_for_hash[hashCount+1]
+                    , start_wall, start_confl);
+                add_measurement(iter, hashCount+1, state.sols_for_hash[hashCount+1]);
                 return;
             }
 
-            threshold_sols[hashCount] = 1;
-            sols_for_hash[hashCount] = threshold+1;
-            if (iter > 0
+            state.set(hashCount, CellState::full, threshold+1);
+            if (!numHashList.empty()
                 && std::abs(hashCount - mPrev) < 2
             ) {
                 //Doing linear, this is a re-count
@@ -657,28 +1997,42 @@ bool Counter::gen_rhs()
     return rhs;
 }
 
-string Counter::gen_rnd_bits(
+static inline uint32_t lowest_set_bit(const uint64_t x)
+{
+    #ifdef __GNUC__
+    return __builtin_ctzll(x);
+    #else
+    uint32_t at = 0;
+    while (((x >> at) & 1ULL) == 0) {
+        at++;
+    }
+    return at;
+    #endif
+}
+
+//Returns the positions in the sampling set that go into the hash.
+//Every position is picked with probability 0.5, or with the sparse
+//probability belonging to this hash index if sparse hashes are used.
+vector<uint32_t> Counter::gen_rnd_bits(
     const uint32_t size,
     // The name of parameter was changed to indicate that this is the index of hash function
     const uint32_t hash_index,
     SparseData& sparse_data)
 {
-    string randomBits;
-    std::uniform_int_distribution<uint32_t> dist{0, 1000};
-    uint32_t cutoff = 500;
+    double prob = 0.5;
     if (conf.sparse && sparse_data.table_no != -1) {
         //Do we need to update the probability?
         const auto& table = constants.index_var_maps[sparse_data.table_no];
-        const auto next_var_index = table.index_var_map[sparse_data.next_index];
-        if (hash_index >= next_var_index) {
+        while (sparse_data.next_index < table.index_var_map.size()
+            && hash_index >= table.index_var_map[sparse_data.next_index]
+        ) {
             sparse_data.sparseprob = constants.probval[sparse_data.next_index];
-            sparse_data.next_index = std::min<uint32_t>(
-                sparse_data.next_index+1, table.index_var_map.size()-1);
+            sparse_data.next_index++;
         }
         assert(sparse_data.sparseprob <= 0.5);
-        cutoff = std::ceil(1000.0*sparse_data.sparseprob);
+        prob = sparse_data.sparseprob;
         if (conf.verb > 3) {
-            cout << "c [sparse] cutoff: " << cutoff
+            cout << "c [sparse] prob: " << prob
             << " table: " << sparse_data.table_no
             << " lookup index: " << sparse_data.next_index
             << " hash index: " << hash_index
@@ -686,14 +2040,33 @@ string Counter::gen_rnd_bits(
         }
     }
 
-    while (randomBits.size() < size) {
-        bool val = dist(randomEngine) < cutoff;
-        randomBits += '0' + val;
+    vector<uint32_t> idxs;
+    if (prob >= 0.5) {
+        //Dense: 64 positions per draw
+        idxs.reserve(size/2 + 64);
+        for (uint32_t at = 0; at < size; at += 64) {
+            uint64_t bits = randomEngine();
+            if (size - at < 64) {
+                bits &= (1ULL << (size - at)) - 1;
+            }
+            while (bits) {
+                idxs.push_back(at + lowest_set_bit(bits));
+                bits &= bits - 1;
+            }
+        }
+    } else {
+        //Sparse: skip over the gaps between picked positions, one draw per
+        //picked position
+        std::geometric_distribution<uint32_t> skip(prob);
+        idxs.reserve(size*prob + 16);
+        uint64_t at = skip(randomEngine);
+        while (at < size) {
+            idxs.push_back(at);
+            at += 1 + (uint64_t)skip(randomEngine);
+        }
     }
-    assert(randomBits.size() >= size);
 
-    //cout << "rnd bits: " << randomBits << endl;
-    return randomBits;
+    return idxs;
 }
 
 void Counter::print_xor(const vector<uint32_t>& vars, const uint32_t rhs)
@@ -761,52 +2134,43 @@ string Counter::get_version_info() const
 void Counter::openLogFile()
 {
     if (!conf.logfilename.empty()) {
-        logfile.open(conf.logfilename.c_str());
-        if (!logfile.is_open()) {
-            cout << "[appmc] Cannot open Counter log file '" << conf.logfilename
-                 << "' for writing." << endl;
-            exit(1);
-        }
-
-        logfile << std::left
-        << std::setw(5) << "sampl"
-        << " " << std::setw(4) << "iter"
-        << " " << std::setw(4) << "hash"
-        << " " << std::setw(4) << "full"
-        << " " << std::setw(4) << "sols"
-        << " " << std::setw(4) << "rep"
-        << " " << std::setw(7) << "T"
-        << " " << std::setw(7) << "total T"
-        << endl;
-
+        //Later counts add to the log of the first one
+        if (!event_log.open(conf.logfilename, startWallTime, num_counts > 0)) {
+            throw ApproxMC::AppMCError("cannot open log file '"
+                + conf.logfilename + "' for writing");
+        }
     }
 }
 
-void Counter::write_log(
-    bool sampling,
-    int iter,
-    uint32_t hashCount,
-    int found_full,
-    uint32_t num_sols,
-    uint32_t repeat_sols,
-    double used_time
-)
+void Counter::log_event(LogEvent& ev)
 {
-    if (!conf.logfilename.empty()) {
-        logfile
-        << std::left
-        << std::setw(5) << (int)sampling
-        << " " << std::setw(4) << iter
-        << " " << std::setw(4) << hashCount
-        << " " << std::setw(4) << found_full
-        << " " << std::setw(4) << num_sols
-        << " " << std::setw(4) << repeat_sols
-        << " " << std::setw(7) << std::fixed << std::setprecision(2) << used_time
-        << " " << std::setw(7) << std::fixed << std::setprecision(2) << (cpuTimeTotal() - startTime)
-        << endl;
+    if (parent) {
+        parent->log_event(ev);
+        return;
+    }
+
+    if (event_log.is_open()) {
+        ev.cpu = cpuTimeTotal() - startTime;
+        event_log.emit(ev);
     }
 }
 
+void Counter::log_measurement(
+    const int iter,
+    const uint64_t hashCount,
+    const int64_t num_sols,
+    const double start_wall,
+    const uint64_t start_confl)
+{
+    LogEvent ev("measurement");
+    ev.iter = iter;
+    ev.hashes = hashCount;
+    ev.sols = num_sols;
+    ev.conflicts = solver->get_sum_conflicts() - start_confl;
+    ev.time = wallTime() - start_wall;
+    log_event(ev);
+}
+
 
 void Counter::check_model(
     const vector<lbool>& model,
@@ -814,8 +2178,11 @@ void Counter::check_model(
     const uint32_t hashCount
 )
 {
-    for(uint32_t var: conf.sampling_set) {
+    vector<uint64_t> packed((conf.sampling_set.size()+63)/64, 0);
+    for(uint32_t i = 0; i < conf.sampling_set.size(); i++) {
+        const uint32_t var = conf.sampling_set[i];
         assert(model[var] != l_Undef);
+        packed[i/64] |= (uint64_t)(model[var] == l_True) << (i%64);
     }
 
     if (!hm)
@@ -823,16 +2190,15 @@ void Counter::check_model(
 
     uint32_t checked = 0;
     bool ok = true;
-    for(const auto& h: hm->hashes) {
-        //This hash is number: h.first
-        //Only has to match hashes at & below
-        //Notice that "h.first" is numbered from 0, so it's a "<" not "<="
-        if (h.first < hashCount) {
-            //cout << "Checking model against hash" << h.first << endl;
-            checked++;
-            ok &= check_model_against_hash(h.second, model);
-            if (!ok) break;
-        }
+    //Only has to match hashes at & below
+    //Notice that hashes are numbered from 0, so it's a "<" not "<="
+    for(uint32_t i = 0; i < hashCount && i < hm->hashes.size(); i++) {
+        const Hash& h = hm->hashes[i];
+        //cout << "Checking model against hash" << i << endl;
+        checked++;
+        ok &= SavedModels::and_parity(
+            packed.data(), h.row.data(), packed.size()) == h.rhs;
+        if (!ok) break;
     }
     assert(ok);
 }
@@ -854,3 +2220,54 @@ bool Counter::check_model_against_hash(const Hash& h, const vector<lbool>& model
     //hence return !rhs
     return !rhs;
 }
+
+bool Counter::check_model_against_hash(
+    const Hash& h, const SavedModels& models, const size_t at)
+{
+    //see above
+    return models.parity(at, h.row) == h.rhs;
+}
+
+ApproxMC::Stats Counter::get_stats() const
+{
+    return stats;
+}
+
+static void add_phase(ApproxMC::PhaseTime& to, const ApproxMC::PhaseTime& from)
+{
+    to.cpu += from.cpu;
+    to.wall += from.wall;
+}
+
+//Called by the workers when they are done, so it must lock
+void Counter::add_stats(const ApproxMC::Stats& other)
+{
+    std::lock_guard<std::mutex> lock(result_mutex);
+    add_phase(stats.initial_check, other.initial_check);
+    add_phase(stats.simplify, other.simplify);
+    add_phase(stats.hash_add, other.hash_add);
+    add_phase(stats.ban_add, other.ban_add);
+    add_phase(stats.sat, other.sat);
+    stats.sat_calls += other.sat_calls;
+    stats.solutions += other.solutions;
+    stats.repeated += other.repeated;
+    stats.xors_added += other.xors_added;
+    stats.cells += other.cells;
+    stats.compactions += other.compactions;
+    stats.cache_hits += other.cache_hits;
+    stats.peak_rss = std::max(stats.peak_rss, other.peak_rss);
+}
+
+void Counter::add_cached_stats(const ApproxMC::Stats& cached)
+{
+    add_stats(cached);
+    std::lock_guard<std::mutex> lock(result_mutex);
+    stats.cache_hits++;
+}
+
+void Counter::sample_rss()
+{
+    double vm_usage;
+    const uint64_t rss = memUsedTotal(vm_usage);
+    stats.peak_rss = std::max(stats.peak_rss, rss);
+}
@@ -35,10 +35,17 @@
 #include <random>
 #include <map>
 #include <cstdint>
+#include <cassert>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <utility>
 #include <cryptominisat5/cryptominisat.h>
 #include "approxmc.h"
 #include "constants.h"
+#include "savedmodels.h"
+#include "eventlog.h"
 
 
 using std::string;
@@ -48,22 +55,12 @@ using std::cout;
 using std::endl;
 using namespace CMSat;
 
-struct SavedModel
-{
-    SavedModel(uint32_t _hash_num, const vector<lbool>& _model) :
-        model(_model),
-        hash_num(_hash_num)
-    {
-    }
-
-    vector<lbool> model;
-    uint32_t hash_num;
-};
-
 struct Hash {
-    Hash(uint32_t _act_var, vector<uint32_t>& _hash_vars, bool _rhs) :
+    Hash(uint32_t _act_var, vector<uint32_t>& _hash_vars,
+         vector<uint32_t>& _hash_idxs, bool _rhs) :
         act_var(_act_var),
         hash_vars(_hash_vars),
+        hash_idxs(_hash_idxs),
         rhs(_rhs)
     {}
 
@@ -72,12 +69,48 @@ struct Hash {
 
     uint32_t act_var;
     vector<uint32_t> hash_vars;
+    vector<uint32_t> hash_idxs; //positions of hash_vars in the sampling set
+    vector<uint64_t> row; //hash_idxs as a packed bit row
     bool rhs;
 };
 
 struct HashesModels {
-    map<uint64_t, Hash> hashes;
-    vector<SavedModel> glob_model; //global table storing models
+    vector<Hash> hashes; //hashes[N] is hash number N
+    SavedModels glob_model; //global table storing models
+};
+
+//What we know about the cell at a given number of hashes
+enum class CellState : uint8_t {
+    unknown = 0,
+    below_threshold = 1,
+    full = 2
+};
+
+//State of the galloping search of one measurement, indexed by number of
+//hashes, which is always in [0, sampling set size + 1]
+struct MeasurementState {
+    explicit MeasurementState(const uint64_t max_hashes) :
+        sols_for_hash(max_hashes+2, 0),
+        threshold_sols(max_hashes+2, CellState::unknown)
+    {}
+
+    bool is(const int64_t hash_num, const CellState st) const
+    {
+        return hash_num >= 0
+            && hash_num < (int64_t)threshold_sols.size()
+            && threshold_sols[hash_num] == st;
+    }
+
+    void set(const int64_t hash_num, const CellState st, const int64_t num_sols)
+    {
+        assert(hash_num >= 0 && hash_num < (int64_t)threshold_sols.size());
+        threshold_sols[hash_num] = st;
+        sols_for_hash[hash_num] = num_sols;
+    }
+
+    //sols_for_hash[N] tells the number of solutions found when N hashes were added
+    vector<int64_t> sols_for_hash;
+    vector<CellState> threshold_sols;
 };
 
 struct SolNum {
@@ -87,6 +120,14 @@ struct SolNum {
     {}
     uint64_t solutions = 0;
     uint64_t repeated = 0;
+    bool stopped = false; //stopped early, solutions is a lower bound
+};
+
+//How enumerate_cubes() ended
+enum class EnumEnd {
+    done, //all solutions of the cell, or maxSolutions, found
+    stopped, //must_stop()
+    out_of_budget //conflict budget used up, solutions found are banned
 };
 
 struct SparseData {
@@ -99,21 +140,50 @@ struct SparseData {
     int table_no = -1;
 };
 
+//Copy of the formula as it was given to us, so further solvers
+//(e.g. one per worker thread) can be set up from it
+struct InputFormula {
+    uint32_t num_vars = 0;
+    vector<vector<Lit>> clauses;
+    vector<std::pair<vector<uint32_t>, bool>> xors;
+};
+
+struct Component;
+struct CubeWork;
+
+//What is read back from a checkpoint besides the measurements
+struct Checkpoint {
+    int64_t start_hash = 0;
+    int64_t mPrev = 0;
+};
+
 class Counter {
 public:
     ApproxMC::SolCount solve(Config _conf);
-    string gen_rnd_bits(const uint32_t size,
+    vector<ApproxMC::SolCount> count_marginals(Config _conf, const vector<Lit>& lits);
+    vector<uint32_t> gen_rnd_bits(const uint32_t size,
                         const uint32_t numhashes, SparseData& sparse_data);
     string binary(const uint32_t x, const uint32_t length);
     bool gen_rhs();
     uint32_t threshold_appmcgen;
     SATSolver* solver = NULL;
+    InputFormula input;
     string get_version_info() const;
     ApproxMC::SolCount calc_est_count();
+    ApproxMC::SolCount calc_partial_count(double& confidence);
+    void save_checkpoint();
+    void interrupt();
+    ApproxMC::Stats get_stats() const;
     void print_final_count_stats(ApproxMC::SolCount sol_count);
     const Constants constants;
+    void add_cached_stats(const ApproxMC::Stats& cached);
+    void replace_input(const InputFormula& in, const Config& _conf);
+    uint32_t num_counts = 0; //finished calls to solve()
+    bool was_stopped = false; //last call to solve() was interrupted
+    bool solver_shared = false; //handed out, must not be replaced
 
 private:
+    friend class CounterBench; //tests/microbench.cpp
     Config conf;
     ApproxMC::SolCount count();
     void add_appmc_options();
@@ -123,11 +193,28 @@ private:
         uint32_t maxSolutions,
         const vector<Lit>* assumps,
         const uint32_t hashCount,
+        const int iter,
         HashesModels* hm = NULL
     );
+    bool count_cell_cubes(
+        const uint64_t maxSolutions,
+        const uint32_t hashCount,
+        HashesModels* hm,
+        const vector<size_t>& repeated,
+        uint64_t& solutions
+    );
+    void cube_worker(CubeWork* work);
+    EnumEnd enumerate_cubes(
+        const uint64_t maxSolutions,
+        const vector<Lit>& cell_assumps,
+        const uint32_t sol_ban_var,
+        const uint32_t hashCount,
+        HashesModels* hm,
+        uint64_t& solutions
+    );
     vector<Lit> set_num_hashes(
         uint32_t num_wanted,
-        map<uint64_t, Hash>& hashes,
+        vector<Hash>& hashes,
         SparseData& sparse_data
     );
     void simplify();
@@ -141,28 +228,78 @@ private:
         const int iter,
         SparseData sparse_data
     );
-    void write_log(
-        bool sampling,
-        int iter,
-        uint32_t hashCount,
-        int found_full,
-        uint32_t num_sols,
-        uint32_t repeat_sols,
-        double used_time
+    bool count_by_components(ApproxMC::SolCount& sol_count);
+    uint64_t enumerate_component(const Component& comp, const uint64_t limit);
+    void components_worker(
+        const vector<Component>* comps,
+        const vector<size_t>* large,
+        std::atomic<size_t>* next,
+        const Config* cconf,
+        vector<ApproxMC::SolCount>* counts
+    );
+    void compact_solver();
+    int64_t estimate_start_hash(const int64_t mPrev, const int64_t max_hashes);
+    void galloping_search(
+        int64_t& mPrev,
+        const int iter,
+        SparseData& sparse_data,
+        HashesModels& hm
+    );
+    void marginals_worker(
+        Counter* c,
+        const uint32_t worker_id,
+        const uint32_t num_workers,
+        const Config& mconf,
+        const vector<Lit>* lits,
+        vector<ApproxMC::SolCount>* counts
     );
+    void parallel_measurements(
+        const uint32_t measurements,
+        const int64_t mPrev,
+        const SparseData& sparse_data,
+        const vector<char>& done
+    );
+    void worker_measurements(
+        const uint32_t worker_id,
+        const uint32_t num_workers,
+        const uint32_t measurements,
+        int64_t mPrev,
+        SparseData sparse_data,
+        const vector<char>* done
+    );
+    void add_measurement(const uint32_t iter, const uint64_t hashCount, const int64_t num_sols);
+    bool read_checkpoint(Checkpoint& cp);
+    void write_checkpoint();
+    string assumptions_str() const;
+    void save_rng_state();
+    void report_progress();
+    void add_stats(const ApproxMC::Stats& other);
+    void sample_rss();
+    void watch_deadline();
+    void stop_deadline_thread(std::thread& deadline_thread);
+    bool must_stop() const;
+    void stop_asap_locked();
+    void register_solver(SATSolver* s);
+    void unregister_solver(SATSolver* s);
+    SATSolver* new_solver_from_input(const InputFormula& in);
+    void log_event(LogEvent& ev);
+    void log_measurement(const int iter, const uint64_t hashCount
+        , const int64_t num_sols, const double start_wall, const uint64_t start_confl);
     void openLogFile();
     void call_after_parse();
-    void ban_one(const uint32_t act_var, const vector<lbool>& model);
+    void ban_one(const uint32_t act_var, const SavedModels& models, const size_t at);
     void check_model(
         const vector<lbool>& model,
         const HashesModels* const hm,
         const uint32_t hashCount
     );
     bool check_model_against_hash(const Hash& h, const vector<lbool>& model);
+    bool check_model_against_hash(const Hash& h, const SavedModels& models, const size_t at);
     uint64_t add_glob_banning_cls(
         const HashesModels* glob_model = NULL
         , const uint32_t act_var = std::numeric_limits<uint32_t>::max()
         , const uint32_t num_hashes = std::numeric_limits<uint32_t>::max()
+        , vector<size_t>* banned = NULL
     );
 
     void readInAFile(SATSolver* solver2, const string& filename);
@@ -173,6 +310,11 @@ private:
     //Data so we can output temporary count when catching the signal
     vector<uint64_t> numHashList;
     vector<int64_t> numCountList;
+    vector<uint32_t> numIterList; //which measurement each one is
+    int64_t start_hash = 0; //hash count the measurements start from
+    string rng_state; //random engine after the last finished measurement
+    uint32_t measurements_total = 0;
+    ApproxMC::SolCount calc_est_count(vector<uint64_t> hashes, vector<int64_t> counts);
     template<class T> T findMedian(vector<T>& numList);
     template<class T> T findMin(vector<T>& numList);
 
@@ -180,12 +322,34 @@ private:
     // internal data
     ////////////////
     double startTime;
-    std::ofstream logfile;
-    std::mt19937 randomEngine;
+    EventLog event_log;
+    bool simplified = false; //the solver is kept simplified between counts
+    uint64_t retired_lits = 0; //in hashes and banning clauses added, see compact_solver()
+    map<int, vector<Hash>> hash_cache; //by measurement, see conf.reuse_hashes
+    std::mt19937_64 randomEngine;
     uint32_t orig_num_vars;
     double total_inter_simp_time = 0;
+    ApproxMC::Stats stats; //workers' are added to the parent's when done
     uint32_t threshold; //precision, it's computed
 
+    //Set when this counter is a worker of another one. Results and log
+    //events are then handed to the parent
+    Counter* parent = NULL;
+    std::mutex result_mutex;
+
+    //Anytime counting. Once the wall-clock budget is used up or interrupt()
+    //is called, stop_asap is set and all solvers working for this counter
+    //are interrupted
+    double startWallTime;
+    std::atomic<bool> stop_asap{false};
+    bool counting_done = false;
+    std::mutex deadline_mutex; //guards counting_done and active_solvers
+    std::condition_variable deadline_cond;
+    vector<SATSolver*> active_solvers;
+    vector<Counter*> sub_counters; //counting marginals or components for us
+    std::atomic<bool> sub_stop{false};
+    std::mutex progress_mutex;
+
     int argc;
     char** argv;
 };
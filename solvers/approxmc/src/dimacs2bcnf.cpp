@@ -0,0 +1,220 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+//Converts DIMACS CNF files to .bcnf, see bcnf.h
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "bcnf.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+struct Cnf {
+    uint64_t num_vars = 0;
+    vector<uint64_t> offsets{0};
+    vector<uint32_t> lits;
+    vector<uint32_t> proj;
+    bool has_proj = false;
+    vector<double> weights;
+};
+
+static bool parse_error(const string& fname, uint64_t line, const string& what)
+{
+    cerr << "PARSE ERROR! " << fname << ":" << line << ": " << what << endl;
+    return false;
+}
+
+static bool read_dimacs(const string& fname, Cnf& cnf)
+{
+    std::ifstream in(fname.c_str(), std::ios::binary);
+    if (!in) {
+        cerr << "ERROR! Could not open file '" << fname << "' for reading: "
+        << strerror(errno) << endl;
+        return false;
+    }
+
+    string line;
+    uint64_t line_num = 0;
+    bool in_clause = false;
+    while (std::getline(in, line)) {
+        line_num++;
+        const char* at = line.c_str();
+        while (*at == ' ' || *at == '\t' || *at == '\r') {
+            at++;
+        }
+        if (*at == 0) {
+            continue;
+        }
+
+        if (*at == 'c' && !in_clause) {
+            std::istringstream ss(at+1);
+            string word;
+            ss >> word;
+            if (word == "ind") {
+                cnf.has_proj = true;
+                long v;
+                while (ss >> v && v != 0) {
+                    if (v < 0) {
+                        return parse_error(fname, line_num, "negative var in 'c ind' line");
+                    }
+                    cnf.proj.push_back(v-1);
+                    cnf.num_vars = std::max<uint64_t>(cnf.num_vars, v);
+                }
+            } else if (word == "weights") {
+                double w;
+                cnf.weights.clear();
+                while (ss >> w) {
+                    cnf.weights.push_back(w);
+                }
+            }
+            continue;
+        }
+        if (*at == 'p' && !in_clause) {
+            std::istringstream ss(at+1);
+            string format;
+            uint64_t vars;
+            uint64_t clauses;
+            if (!(ss >> format >> vars >> clauses) || format != "cnf") {
+                return parse_error(fname, line_num, "bad 'p cnf' header");
+            }
+            cnf.num_vars = std::max(cnf.num_vars, vars);
+            continue;
+        }
+        if (*at == 'x') {
+            return parse_error(fname, line_num, "XOR clauses cannot be stored in .bcnf");
+        }
+
+        //Clause, possibly continued from the previous line
+        char* next;
+        while (true) {
+            while (*at == ' ' || *at == '\t' || *at == '\r') {
+                at++;
+            }
+            if (*at == 0) {
+                break;
+            }
+            errno = 0;
+            const long lit = strtol(at, &next, 10);
+            if (next == at || errno != 0 || lit > (1L << 28) || lit < -(1L << 28)) {
+                return parse_error(fname, line_num, string("unexpected '") + at + "'");
+            }
+            at = next;
+            if (lit == 0) {
+                cnf.offsets.push_back(cnf.lits.size());
+                in_clause = false;
+                continue;
+            }
+            const uint32_t var = std::labs(lit) - 1;
+            cnf.lits.push_back(2*var + (lit < 0));
+            cnf.num_vars = std::max<uint64_t>(cnf.num_vars, var+1);
+            in_clause = true;
+        }
+    }
+    if (in_clause) {
+        return parse_error(fname, line_num, "last clause is not terminated by 0");
+    }
+    if (!cnf.weights.empty() && cnf.weights.size() != 2*cnf.num_vars) {
+        return parse_error(fname, line_num, "'c weights' needs two weights per variable");
+    }
+    return true;
+}
+
+static int convert(const string& fname, const string& out_name)
+{
+    Cnf cnf;
+    if (!read_dimacs(fname, cnf)) {
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(fname.c_str(), &st) != 0) {
+        cerr << "ERROR! Could not stat '" << fname << "': " << strerror(errno) << endl;
+        return -1;
+    }
+
+    const int ret = bcnf_write(
+        out_name.c_str(),
+        cnf.num_vars,
+        cnf.offsets.data(), cnf.offsets.size()-1,
+        cnf.lits.data(),
+        cnf.proj.data(), cnf.proj.size(), cnf.has_proj,
+        cnf.weights.empty() ? NULL : cnf.weights.data(),
+        st.st_size, bcnf_mtime_ns(&st)
+    );
+    if (ret != 0) {
+        cerr << "ERROR! Could not write '" << out_name << "': " << strerror(errno) << endl;
+        return -1;
+    }
+    cout << fname << " -> " << out_name << " ("
+    << cnf.num_vars << " vars, " << cnf.offsets.size()-1 << " clauses)" << endl;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        cout << "Usage: " << argv[0] << " [-o OUT.bcnf] FILE.dimacs [FILE.dimacs ...]" << endl
+        << "Writes FILE.bcnf next to every FILE.dimacs, unless -o is given." << endl
+        << "approxmc picks up the .bcnf as long as FILE.dimacs is unchanged." << endl;
+        return argc < 2 ? -1 : 0;
+    }
+
+    string out_name;
+    int first = 1;
+    if (strcmp(argv[1], "-o") == 0) {
+        if (argc != 4) {
+            cerr << "ERROR! -o needs exactly one input file" << endl;
+            return -1;
+        }
+        out_name = argv[2];
+        first = 3;
+    }
+
+    int ret = 0;
+    for (int i = first; i < argc; i++) {
+        string out = out_name;
+        if (out.empty()) {
+            char* name = bcnf_name_for(argv[i]);
+            out = name;
+            free(name);
+        }
+        ret |= convert(argv[i], out);
+    }
+    return ret;
+}
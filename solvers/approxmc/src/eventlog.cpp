@@ -0,0 +1,178 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "eventlog.h"
+#include "time_mem.h"
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+
+using std::string;
+using std::vector;
+
+//Wake the writer early once this many events are waiting
+static const size_t wake_at = 1024;
+
+EventLog::~EventLog()
+{
+    close();
+}
+
+bool EventLog::open(const string& filename, double _start_wall, bool append)
+{
+    close();
+    out.open(filename.c_str(), append ? std::ios::app : std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    csv = filename.size() >= 4 && filename.compare(filename.size()-4, 4, ".csv") == 0;
+    start_wall = _start_wall;
+    closing = false;
+
+    if (csv && !append) {
+        out << "event,iter,hashes,sols,full,repeat,conflicts,propagations"
+        ",xor_vars,xor_len,time,simp_time,cpu,wall,rss\n";
+    }
+    writer_thread = std::thread(&EventLog::writer, this);
+    return true;
+}
+
+bool EventLog::is_open() const
+{
+    return out.is_open();
+}
+
+void EventLog::emit(LogEvent ev)
+{
+    ev.wall = wallTime() - start_wall;
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(ev);
+    if (pending.size() >= wake_at) {
+        cond.notify_one();
+    }
+}
+
+void EventLog::close()
+{
+    if (!writer_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    cond.notify_one();
+    writer_thread.join();
+    out.close();
+}
+
+void EventLog::writer()
+{
+    vector<LogEvent> evs;
+    while (true) {
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait_for(lock, std::chrono::seconds(1), [this] {
+                return closing || pending.size() >= wake_at;
+            });
+            evs.swap(pending);
+            done = closing;
+        }
+        write_events(evs);
+        evs.clear();
+        if (done) {
+            return;
+        }
+    }
+}
+
+static void add_int(std::ostringstream& ss, bool csv, const char* name, int64_t val)
+{
+    if (csv) {
+        ss << ',';
+        if (val != -1) {
+            ss << val;
+        }
+    } else if (val != -1) {
+        ss << ",\"" << name << "\":" << val;
+    }
+}
+
+static void add_double(std::ostringstream& ss, bool csv, const char* name, double val)
+{
+    char buf[32];
+    if (val != -1) {
+        snprintf(buf, sizeof(buf), "%.6g", val);
+    }
+    if (csv) {
+        ss << ',';
+        if (val != -1) {
+            ss << buf;
+        }
+    } else if (val != -1) {
+        ss << ",\"" << name << "\":" << buf;
+    }
+}
+
+void EventLog::write_events(const vector<LogEvent>& evs)
+{
+    if (evs.empty()) {
+        return;
+    }
+
+    double vm;
+    const int64_t rss = memUsedTotal(vm);
+
+    std::ostringstream ss;
+    for (const LogEvent& ev: evs) {
+        if (csv) {
+            ss << ev.kind;
+        } else {
+            ss << "{\"event\":\"" << ev.kind << "\"";
+        }
+        add_int(ss, csv, "iter", ev.iter);
+        add_int(ss, csv, "hashes", ev.hashes);
+        add_int(ss, csv, "sols", ev.sols);
+        add_int(ss, csv, "full", ev.full);
+        add_int(ss, csv, "repeat", ev.repeat);
+        add_int(ss, csv, "conflicts", ev.conflicts);
+        add_int(ss, csv, "propagations", ev.propagations);
+        add_int(ss, csv, "xor_vars", ev.xor_vars);
+        add_double(ss, csv, "xor_len", ev.xor_len);
+        add_double(ss, csv, "time", ev.time);
+        add_double(ss, csv, "simp_time", ev.simp_time);
+        add_double(ss, csv, "cpu", ev.cpu);
+        add_double(ss, csv, "wall", ev.wall);
+        add_int(ss, csv, "rss", rss);
+        ss << (csv ? "\n" : "}\n");
+    }
+    out << ss.str();
+    out.flush();
+}
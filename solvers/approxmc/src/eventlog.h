@@ -0,0 +1,90 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef EVENTLOG_H_
+#define EVENTLOG_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//One line of the log. Fields that do not apply to the event are left at -1
+//and are written as empty (CSV) or left out (JSON)
+struct LogEvent {
+    explicit LogEvent(const char* _kind) :
+        kind(_kind)
+    {}
+
+    const char* kind; //"count", "simplify" or "measurement"
+    int64_t iter = -1;
+    int64_t hashes = -1;
+    int64_t sols = -1;
+    int64_t full = -1;
+    int64_t repeat = -1; //solutions that came from saved models
+    int64_t conflicts = -1;
+    int64_t propagations = -1;
+    int64_t xor_vars = -1; //total length of the active XORs
+    double xor_len = -1; //average length of the active XORs
+    double time = -1; //wall-clock time the event took
+    double simp_time = -1; //of that, spent simplifying
+    double cpu = -1; //CPU time of the counter since it started
+    double wall = -1; //set by emit()
+};
+
+//Writes events as JSON Lines or, if the file name ends in ".csv", as CSV.
+//Events are handed to a background thread, so emit() never waits for the
+//disk. It writes out what it has every second, or sooner if a lot piled up,
+//adding the resident memory at the time of writing
+class EventLog {
+public:
+    ~EventLog();
+    bool open(const std::string& filename, double start_wall, bool append = false);
+    bool is_open() const;
+    void emit(LogEvent ev);
+    void close();
+
+private:
+    void writer();
+    void write_events(const std::vector<LogEvent>& evs);
+
+    std::ofstream out;
+    bool csv = false;
+    double start_wall = 0;
+
+    std::thread writer_thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<LogEvent> pending;
+    bool closing = false;
+};
+
+#endif //EVENTLOG_H_
@@ -0,0 +1,226 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "indsupport.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "bcnf.h"
+#include "time_mem.h"
+#include "tmpname.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+using namespace CMSat;
+
+IndSupport::IndSupport(const InputFormula& in, uint32_t verbosity) :
+    num_vars(in.num_vars),
+    verb(verbosity),
+    occurs(in.num_vars, 0)
+{
+    solver = new SATSolver();
+    solver->new_vars(3*num_vars);
+    add_copies(in);
+}
+
+IndSupport::~IndSupport()
+{
+    delete solver;
+}
+
+void IndSupport::add_copies(const InputFormula& in)
+{
+    vector<Lit> cl2;
+    for (const auto& cl: in.clauses) {
+        cl2.clear();
+        for (const Lit l: cl) {
+            occurs[l.var()]++;
+            cl2.push_back(Lit(copy_var(l.var()), l.sign()));
+        }
+        solver->add_clause(cl);
+        solver->add_clause(cl2);
+    }
+
+    vector<uint32_t> vars2;
+    for (const auto& x: in.xors) {
+        vars2.clear();
+        for (const uint32_t v: x.first) {
+            occurs[v]++;
+            vars2.push_back(copy_var(v));
+        }
+        solver->add_xor_clause(x.first, x.second);
+        solver->add_xor_clause(vars2, x.second);
+    }
+
+    //indicator -> (v == v')
+    for (uint32_t v = 0; v < num_vars; v++) {
+        solver->add_clause({Lit(indic_var(v), true), Lit(v, false), Lit(copy_var(v), true)});
+        solver->add_clause({Lit(indic_var(v), true), Lit(v, true), Lit(copy_var(v), false)});
+    }
+}
+
+vector<uint32_t> IndSupport::find(uint64_t max_confl_per_var)
+{
+    const double start_time = cpuTime();
+
+    //Variables in many clauses are the likeliest to be defined. Those in
+    //none are free, they are never defined
+    vector<uint32_t> order;
+    for (uint32_t v = 0; v < num_vars; v++) {
+        if (occurs[v] > 0) {
+            order.push_back(v);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return occurs[a] > occurs[b];
+    });
+
+    vector<char> in_support(num_vars, 1);
+    uint64_t undef = 0;
+    vector<Lit> assumps;
+    for (const uint32_t v: order) {
+        assumps.clear();
+        for (uint32_t u = 0; u < num_vars; u++) {
+            if (u != v && in_support[u]) {
+                assumps.push_back(Lit(indic_var(u), false));
+            }
+        }
+        assumps.push_back(Lit(v, false));
+        assumps.push_back(Lit(copy_var(v), true));
+
+        solver->set_max_confl(max_confl_per_var);
+        const lbool ret = solver->solve(&assumps);
+        if (ret == l_False) {
+            in_support[v] = 0;
+        } else if (ret == l_Undef) {
+            undef++;
+        }
+    }
+
+    vector<uint32_t> ind;
+    for (uint32_t v = 0; v < num_vars; v++) {
+        if (in_support[v]) {
+            ind.push_back(v);
+        }
+    }
+
+    //An empty support would mean "no support given". Any superset of an
+    //independent support is one too
+    if (ind.empty() && num_vars > 0) {
+        ind.push_back(0);
+    }
+
+    if (verb) {
+        cout << "c [appmc] Independent support: " << ind.size()
+        << " of " << num_vars << " variables"
+        << " (" << undef << " undecided within the conflict limit)"
+        << " T: " << std::setprecision(2) << std::fixed
+        << (cpuTime() - start_time) << endl;
+    }
+    return ind;
+}
+
+uint64_t IndSupport::fingerprint(const InputFormula& in)
+{
+    uint64_t h = 14695981039346656037ULL;
+    h = bcnf_fnv1a(h, &in.num_vars, sizeof(in.num_vars));
+    vector<uint32_t> buf;
+    for (const auto& cl: in.clauses) {
+        buf.clear();
+        buf.push_back(cl.size());
+        for (const Lit l: cl) {
+            buf.push_back(l.toInt());
+        }
+        h = bcnf_fnv1a(h, buf.data(), buf.size()*sizeof(uint32_t));
+    }
+    for (const auto& x: in.xors) {
+        buf.clear();
+        buf.push_back(x.first.size());
+        buf.push_back(x.second);
+        buf.insert(buf.end(), x.first.begin(), x.first.end());
+        h = bcnf_fnv1a(h, buf.data(), buf.size()*sizeof(uint32_t));
+    }
+    return h;
+}
+
+string IndSupport::cache_name(const string& dir, const InputFormula& in)
+{
+    std::stringstream ss;
+    ss << dir << "/" << std::hex << std::setw(16) << std::setfill('0')
+    << fingerprint(in) << ".ind";
+    return ss.str();
+}
+
+//The cache file is a "c ind" line, as it would be put into the CNF
+bool IndSupport::read_cache(const string& dir, const InputFormula& in, vector<uint32_t>& ind)
+{
+    std::ifstream f(cache_name(dir, in).c_str());
+    if (!f) {
+        return false;
+    }
+
+    string c, word;
+    f >> c >> word;
+    if (c != "c" || word != "ind") {
+        return false;
+    }
+    vector<uint32_t> vars;
+    int64_t v;
+    while (f >> v && v != 0) {
+        if (v < 0 || v > in.num_vars) {
+            return false;
+        }
+        vars.push_back(v-1);
+    }
+    if (v != 0 || vars.empty()) {
+        return false;
+    }
+    ind = vars;
+    return true;
+}
+
+void IndSupport::write_cache(const string& dir, const InputFormula& in, const vector<uint32_t>& ind)
+{
+    const string name = cache_name(dir, in);
+    const string tmp_name = tmp_file_name(name);
+    std::ofstream f(tmp_name.c_str());
+    f << "c ind";
+    for (const uint32_t v: ind) {
+        f << " " << v+1;
+    }
+    f << " 0" << endl;
+    f.close();
+
+    if (!f || std::rename(tmp_name.c_str(), name.c_str()) != 0) {
+        cout << "c [appmc] WARNING: could not write independent support cache '"
+        << name << "'" << endl;
+        std::remove(tmp_name.c_str());
+    }
+}
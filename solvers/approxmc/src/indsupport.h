@@ -0,0 +1,70 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef INDSUPPORT_H_
+#define INDSUPPORT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "counter.h"
+
+//Finds an independent support of a formula: a set of variables whose
+//values determine the values of all the others, so counting the solutions
+//projected on it gives the number of solutions. Uses Padoa's method: v is
+//defined by the set S if F(X) and F(X') with X and X' agreeing on S cannot
+//differ on v. The formula is copied once, and every agreement is switched
+//on by an indicator variable, so each variable is one incremental SAT call.
+class IndSupport {
+public:
+    IndSupport(const InputFormula& in, uint32_t verbosity);
+    ~IndSupport();
+
+    //Variables that could not be shown to be defined within
+    //max_confl_per_var conflicts stay in the support
+    std::vector<uint32_t> find(uint64_t max_confl_per_var);
+
+    //Results are cached under 'dir' keyed by the formula's fingerprint
+    static uint64_t fingerprint(const InputFormula& in);
+    static bool read_cache(const std::string& dir, const InputFormula& in
+        , std::vector<uint32_t>& ind);
+    static void write_cache(const std::string& dir, const InputFormula& in
+        , const std::vector<uint32_t>& ind);
+
+private:
+    void add_copies(const InputFormula& in);
+    static std::string cache_name(const std::string& dir, const InputFormula& in);
+
+    const uint32_t num_vars;
+    const uint32_t verb;
+    std::vector<uint32_t> occurs; //number of clauses and XORs a var is in
+    CMSat::SATSolver* solver;
+
+    //Variables of the second copy of the formula and the indicators
+    uint32_t copy_var(const uint32_t v) const { return v + num_vars; }
+    uint32_t indic_var(const uint32_t v) const { return v + 2*num_vars; }
+};
+
+#endif //INDSUPPORT_H_
@@ -37,8 +37,29 @@ using std::vector;
 #endif
 #include <signal.h>
 #include <gmp.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "approxmc.h"
+#include "time_mem.h"
+#include "mmapdimacs.h"
+#include "bcnf.h"
 #include <cryptominisat5/dimacsparser.h>
 #include <cryptominisat5/streambuffer.h>
 
@@ -46,78 +67,149 @@ using namespace CMSat;
 using std::cout;
 using std::cerr;
 using std::endl;
-ApproxMC::AppMC* appmc = NULL;
-
-po::options_description main_options = po::options_description("Main options");
-po::options_description improvement_options = po::options_description("Improvement options");
-po::options_description misc_options = po::options_description("Misc options");
-po::options_description help_options;
-po::variables_map vm;
-po::positional_options_description p;
-uint32_t verbosity = 1;
-uint32_t seed;
-double epsilon;
-double delta;
-string logfilename;
-uint32_t start_iter = 0;
-uint32_t verb_cls = 0;
-uint32_t simplify;
-double var_elim_ratio;
-uint32_t detach_xors = 1;
-uint32_t reuse_models = 1;
-uint32_t force_sol_extension = 0;
-uint32_t sparse;
-
-void add_appmc_options()
+
+//Everything given on the command line. main() owns the only copy and
+//passes it on, so the batch and server threads share no mutable state
+struct Options {
+    uint32_t verbosity = 1;
+    uint32_t seed;
+    double epsilon;
+    double delta;
+    string logfilename;
+    uint32_t start_iter = 0;
+    uint32_t verb_cls = 0;
+    uint32_t simplify;
+    double var_elim_ratio;
+    uint32_t detach_xors = 1;
+    uint32_t reuse_models = 1;
+    uint32_t force_sol_extension = 0;
+    uint32_t sparse;
+    uint32_t fast_hit;
+    uint32_t enum_engine;
+    uint64_t enum_confl;
+    uint64_t compact_lits;
+    uint32_t cube_threads;
+    uint32_t cube_vars;
+    uint32_t num_threads;
+    uint32_t batch_jobs = 0;
+    string batch_list;
+    string checkpoint_file;
+    uint32_t resume = 0;
+    double max_time = 0;
+    string server_socket;
+    string marginals;
+    uint32_t ind_support;
+    uint32_t components;
+    string ind_support_cache;
+    uint32_t preprocess;
+    string preprocess_cache;
+    string result_cache;
+};
+
+void add_appmc_options(Options& opt, po::options_description& help_options)
 {
+    po::options_description main_options("Main options");
+    po::options_description improvement_options("Improvement options");
+    po::options_description misc_options("Misc options");
+
     ApproxMC::AppMC tmp;
-    epsilon = tmp.get_epsilon();
-    delta = tmp.get_delta();
-    simplify = tmp.get_simplify();
-    var_elim_ratio = tmp.get_var_elim_ratio();
-    sparse = tmp.get_sparse();
-    seed = tmp.get_seed();
+    opt.epsilon = tmp.get_epsilon();
+    opt.delta = tmp.get_delta();
+    opt.simplify = tmp.get_simplify();
+    opt.var_elim_ratio = tmp.get_var_elim_ratio();
+    opt.sparse = tmp.get_sparse();
+    opt.fast_hit = tmp.get_fast_hit();
+    opt.enum_engine = tmp.get_enum_engine();
+    opt.enum_confl = tmp.get_enum_confl();
+    opt.compact_lits = tmp.get_compact();
+    opt.cube_threads = tmp.get_cube_threads();
+    opt.cube_vars = tmp.get_cube_vars();
+    opt.seed = tmp.get_seed();
+    opt.num_threads = tmp.get_num_threads();
+    opt.ind_support = tmp.get_ind_support();
+    opt.components = tmp.get_components();
+    opt.preprocess = tmp.get_preprocess();
 
     std::ostringstream my_epsilon;
     std::ostringstream my_delta;
     std::ostringstream my_var_elim_ratio;
 
-    my_epsilon << std::setprecision(8) << epsilon;
-    my_delta << std::setprecision(8) << delta;
-    my_var_elim_ratio << std::setprecision(8) << var_elim_ratio;
+    my_epsilon << std::setprecision(8) << opt.epsilon;
+    my_delta << std::setprecision(8) << opt.delta;
+    my_var_elim_ratio << std::setprecision(8) << opt.var_elim_ratio;
  
     main_options.add_options()
     ("help,h", "Prints help")
     ("input", po::value< vector<string> >(), "file(s) to read")
-    ("verb,v", po::value(&verbosity)->default_value(1), "verbosity")
-    ("seed,s", po::value(&seed)->default_value(seed), "Seed")
+    ("verb,v", po::value(&opt.verbosity)->default_value(1), "verbosity")
+    ("seed,s", po::value(&opt.seed)->default_value(opt.seed), "Seed")
     ("version", "Print version info")
 
-    ("epsilon", po::value(&epsilon)->default_value(epsilon, my_epsilon.str())
+    ("epsilon", po::value(&opt.epsilon)->default_value(opt.epsilon, my_epsilon.str())
         , "epsilon parameter as per PAC guarantees")
-    ("delta", po::value(&delta)->default_value(delta, my_delta.str())
+    ("delta", po::value(&opt.delta)->default_value(opt.delta, my_delta.str())
         , "delta parameter as per PAC guarantees; 1-delta is the confidence")
-    ("log", po::value(&logfilename),
-         "Logs of ApproxMC execution")
+    ("log", po::value(&opt.logfilename),
+         "Log every SAT call and measurement to this file as JSON Lines, or as CSV if the name ends in .csv")
+    ("threads", po::value(&opt.num_threads)->default_value(opt.num_threads)
+        , "Number of threads to run the measurements on")
+    ("jobs", po::value(&opt.batch_jobs)->default_value(opt.batch_jobs)
+        , "Batch mode: number of CNFs to count at the same time. 0 = number of cores")
+    ("batchlist", po::value(&opt.batch_list)
+        , "Batch mode: file with one CNF path per line")
+    ("server", po::value(&opt.server_socket)
+        , "Serve counting requests on this Unix socket. --jobs sets how many are counted at the same time")
+    ("checkpoint", po::value(&opt.checkpoint_file)
+        , "Save finished measurements to this file as they complete")
+    ("resume", po::value(&opt.resume)->default_value(opt.resume)
+        , "Continue from the measurements in the checkpoint file")
+    ("maxtime", po::value(&opt.max_time)->default_value(opt.max_time)
+        , "Wall-clock seconds to count for, then give the estimate from the measurements done. 0 = no limit")
+    ("marginals", po::value(&opt.marginals)
+        , "Count the solutions with each of these comma-separated literals set, e.g. '1,-5', or with each sampling set variable set if 'ind'. --threads sets how many are counted at the same time")
     ;
 
     improvement_options.add_options()
-    ("sparse", po::value(&sparse)->default_value(sparse)
+    ("sparse", po::value(&opt.sparse)->default_value(opt.sparse)
         , "Generate sparse XORs when possible")
-    ("detachxor", po::value(&detach_xors)->default_value(detach_xors)
+    ("fasthit", po::value(&opt.fast_hit)->default_value(opt.fast_hit)
+        , "In the hash search, jump by log2(threshold/solutions found) instead of to the midpoint, and start where earlier measurements ended up")
+    ("detachxor", po::value(&opt.detach_xors)->default_value(opt.detach_xors)
         , "Detach XORs in CMS")
-    ("reusemodels", po::value(&reuse_models)->default_value(reuse_models)
+    ("enumengine", po::value(&opt.enum_engine)->default_value(opt.enum_engine)
+        , "Enumerate the solutions of a cell by flipping assumed sampling set values instead of adding banning clauses")
+    ("enumconfl", po::value(&opt.enum_confl)->default_value(opt.enum_confl)
+        , "Conflicts the enumeration engine may use per cell before it falls back to banning clauses. 0 = no limit")
+    ("cubethreads", po::value(&opt.cube_threads)->default_value(opt.cube_threads)
+        , "Threads to enumerate the solutions of one cell on, split into cubes on sampling set variables")
+    ("cubevars", po::value(&opt.cube_vars)->default_value(opt.cube_vars)
+        , "Split cells on this many sampling set variables. 0 = chosen from --cubethreads")
+    ("compact", po::value(&opt.compact_lits)->default_value(opt.compact_lits)
+        , "Rebuild the solver between measurements once old hashes and banning clauses hold this many literals, and more than the CNF. 0 = never")
+    ("reusemodels", po::value(&opt.reuse_models)->default_value(opt.reuse_models)
         , "Reuse models while counting solutions")
-    ("forcesolextension", po::value(&force_sol_extension)->default_value(force_sol_extension)
+    ("forcesolextension", po::value(&opt.force_sol_extension)->default_value(opt.force_sol_extension)
         , "Use trick of not extending solutions in the SAT solver to full solution")
+    ("indsupport", po::value(&opt.ind_support)->default_value(opt.ind_support)
+        , "If the CNF has no 'c ind' line, count on an independent support found by definability checks")
+    ("indcache", po::value(&opt.ind_support_cache)
+        , "Directory to keep the independent supports found in, by CNF fingerprint")
+    ("preprocess", po::value(&opt.preprocess)->default_value(opt.preprocess)
+        , "Fix units, substitute equivalent literals and eliminate variables outside the sampling set before counting")
+    ("precache", po::value(&opt.preprocess_cache)
+        , "Directory to keep preprocessed CNFs in, by fingerprint of the CNF and sampling set")
+    ("resultcache", po::value(&opt.result_cache)
+        , "Directory to keep finished counts in, by fingerprint of the CNF, sampling set and parameters")
+    ("components", po::value(&opt.components)->default_value(opt.components)
+        , "Count the variable-disjoint components of the CNF separately, small ones exactly")
     ;
 
     misc_options.add_options()
-    ("verbcls", po::value(&verb_cls)->default_value(verb_cls)
+    ("verbcls", po::value(&opt.verb_cls)->default_value(opt.verb_cls)
         ,"Print banning clause + xor clauses. Highly verbose.")
-    ("simplify", po::value(&simplify)->default_value(simplify)
+    ("simplify", po::value(&opt.simplify)->default_value(opt.simplify)
         , "Simplify agressiveness")
-    ("velimratio", po::value(&var_elim_ratio)->default_value(var_elim_ratio)
+    ("velimratio", po::value(&opt.var_elim_ratio)->default_value(opt.var_elim_ratio)
         , "Variable elimination ratio for each simplify run")
     ;
 
@@ -126,10 +218,12 @@ void add_appmc_options()
     help_options.add(misc_options);
 }
 
-void add_supported_options(int argc, char** argv)
+void add_supported_options(int argc, char** argv, Options& opt, po::variables_map& vm)
 {
-    add_appmc_options();
-    p.add("input", 1);
+    po::options_description help_options;
+    po::positional_options_description p;
+    add_appmc_options(opt, help_options);
+    p.add("input", -1);
 
     try {
         po::store(po::command_line_parser(argc, argv).options(help_options).positional(p).run(), vm);
@@ -139,14 +233,16 @@ void add_supported_options(int argc, char** argv)
             << "Probably Approximate counter" << endl;
 
             cout
-            << "approxmc [options] inputfile" << endl << endl;
+            << "approxmc [options] inputfile" << endl
+            << "approxmc [options] inputfile(s)/directory(ies)   -- batch mode" << endl << endl;
 
             cout << help_options << endl;
             std::exit(0);
         }
 
         if (vm.count("version")) {
-            cout << appmc->get_version_info();
+            ApproxMC::AppMC tmp;
+            cout << tmp.get_version_info();
             std::exit(0);
         }
 
@@ -228,29 +324,85 @@ void add_supported_options(int argc, char** argv)
 
 }
 
-// void SIGINT_handler(int)
-// {
-//     if (!appmc) {
-//         return;
-//     }
-//     SolCount solCount = appmc->calc_est_count();
-//     if (!solCount.valid) {
-//         cout << "c did not manage to get a single measurement, we have no estimate of the count" << endl;
-//         exit(-1);
-//     }
-//     cout << "c Below count is NOT FULLY APPROXIMIATE due to early-abort!" << endl;
-//     solCount.print_num_solutions();
-//     exit(-1);
-// }
-
-void read_in_file(const string& filename)
+//Loads FILE.bcnf instead of FILE if it was made from the current FILE,
+//or FILE itself if it is a .bcnf. Returns 1 if loaded, 0 if there is no
+//.bcnf to use and -1 on error
+int read_in_bcnf(ApproxMC::AppMC* counter, const string& filename, uint32_t verb)
+{
+    bcnf_file f;
+    string name = filename;
+    if (bcnf_is_bcnf_name(filename.c_str())) {
+        if (bcnf_map(filename.c_str(), NULL, &f) != 0) {
+            std::cerr << "ERROR! '" << filename << "' is not a valid .bcnf file" << endl;
+            return -1;
+        }
+    } else {
+        char* bname = bcnf_name_for(filename.c_str());
+        name = bname;
+        free(bname);
+        if (bcnf_map(name.c_str(), filename.c_str(), &f) != 0) {
+            return 0;
+        }
+    }
+    if (bcnf_check(&f) != 0) {
+        std::cerr << "ERROR! '" << name << "' is corrupt" << endl;
+        bcnf_unmap(&f);
+        return -1;
+    }
+
+    const bcnf_header* h = f.header;
+    if (h->num_vars > counter->nVars()) {
+        counter->new_vars(h->num_vars - counter->nVars());
+    }
+    vector<CMSat::Lit> lits;
+    for (uint64_t i = 0; i < h->num_clauses; i++) {
+        for (uint64_t j = f.offsets[i]; j < f.offsets[i+1]; j++) {
+            lits.push_back(CMSat::Lit::toLit(f.lits[j]));
+        }
+        lits.push_back(CMSat::lit_Undef);
+        if (lits.size() >= (1 << 16)) {
+            counter->add_clauses(lits);
+            lits.clear();
+        }
+    }
+    counter->add_clauses(lits);
+    counter->set_projection_set(vector<uint32_t>(f.proj, f.proj + h->num_proj));
+
+    if (verb) {
+        cout << "c [appmc] Loaded '" << name << "': " << h->num_vars << " vars, "
+        << h->num_clauses << " clauses, fingerprint "
+        << std::hex << std::setw(16) << std::setfill('0') << h->fingerprint
+        << std::dec << std::setfill(' ') << endl;
+    }
+    bcnf_unmap(&f);
+    return 1;
+}
+
+bool read_in_file(ApproxMC::AppMC* counter, const string& filename, uint32_t verb)
 {
+    const int bcnf = read_in_bcnf(counter, filename, verb);
+    if (bcnf != 0) {
+        return bcnf == 1;
+    }
+
+    //Plain files are parsed straight from memory
+    {
+        MmapDimacsParser mparser(counter, verb);
+        if (mparser.map_file(filename)) {
+            const bool ok = mparser.parse_mapped();
+            if (ok) {
+                counter->set_projection_set(mparser.sampling_vars);
+            }
+            return ok;
+        }
+    }
+
     #ifndef USE_ZLIB
     FILE * in = fopen(filename.c_str(), "rb");
-    DimacsParser<StreamBuffer<FILE*, FN>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<FILE*, FN>, ApproxMC::AppMC> parser(counter, NULL, verb);
     #else
     gzFile in = gzopen(filename.c_str(), "rb");
-    DimacsParser<StreamBuffer<gzFile, GZ>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<gzFile, GZ>, ApproxMC::AppMC> parser(counter, NULL, verb);
     #endif
 
     if (in == NULL) {
@@ -259,23 +411,24 @@ void read_in_file(const string& filename)
         << filename
         << "' for reading: " << strerror(errno) << endl;
 
-        std::exit(-1);
+        return false;
     }
 
-    if (!parser.parse_DIMACS(in, false)) {
-        exit(-1);
+    bool ok = parser.parse_DIMACS(in, false);
+    if (ok) {
+        counter->set_projection_set(parser.sampling_vars);
     }
 
-    appmc->set_projection_set(parser.sampling_vars);
-
     #ifndef USE_ZLIB
     fclose(in);
     #else
     gzclose(in);
     #endif
+
+    return ok;
 }
 
-void read_stdin()
+void read_stdin(ApproxMC::AppMC* counter, uint32_t verb)
 {
     cout
     << "c Reading from standard input... Use '-h' or '--help' for help."
@@ -293,37 +446,883 @@ void read_stdin()
     }
 
     #ifndef USE_ZLIB
-    DimacsParser<StreamBuffer<FILE*, FN>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<FILE*, FN>, ApproxMC::AppMC> parser(counter, NULL, verb);
     #else
-    DimacsParser<StreamBuffer<gzFile, GZ>, ApproxMC::AppMC> parser(appmc, NULL, verbosity);
+    DimacsParser<StreamBuffer<gzFile, GZ>, ApproxMC::AppMC> parser(counter, NULL, verb);
     #endif
 
     if (!parser.parse_DIMACS(in, false)) {
         exit(-1);
     }
 
-    appmc->set_projection_set(parser.sampling_vars);
+    counter->set_projection_set(parser.sampling_vars);
 
     #ifdef USE_ZLIB
     gzclose(in);
     #endif
 }
 
-void print_num_solutions(uint32_t cellSolCount, uint32_t hashCount)
+string num_solutions_str(uint32_t cellSolCount, uint32_t hashCount)
 {
-    cout << "c [appmc] Number of solutions is: "
-    << cellSolCount << "*2**" << hashCount << endl;
-
     mpz_t num_sols;
     mpz_init (num_sols);
     mpz_ui_pow_ui(num_sols, 2, hashCount);
     mpz_mul_ui(num_sols, num_sols, cellSolCount);
 
-    cout << "s mc " << std::flush;
-    mpz_out_str(0, 10, num_sols);
-    cout << endl;
+    char* str = mpz_get_str(NULL, 10, num_sols);
+    string ret(str);
+    void (*freefunc)(void *, size_t);
+    mp_get_memory_functions(NULL, NULL, &freefunc);
+    freefunc(str, strlen(str)+1);
     mpz_clear(num_sols);
 
+    return ret;
+}
+
+void print_num_solutions(uint32_t cellSolCount, uint32_t hashCount)
+{
+    cout << "c [appmc] Number of solutions is: "
+    << cellSolCount << "*2**" << hashCount << endl;
+    cout << "s mc " << num_solutions_str(cellSolCount, hashCount) << endl;
+}
+
+#ifndef _WIN32
+//Signals are blocked in every thread and taken here instead, so the
+//checkpoint can be written with the counter's locks taken normally
+void signal_waiter(sigset_t set, ApproxMC::AppMC* counter, string checkpoint_file)
+{
+    int sig;
+    if (sigwait(&set, &sig) != 0) {
+        return;
+    }
+
+    counter->write_checkpoint();
+    double confidence = 0;
+    ApproxMC::SolCount sol_count = counter->get_partial_count(&confidence);
+    if (!sol_count.valid) {
+        cout << "c did not manage to get a single measurement, we have no estimate of the count" << endl;
+    } else {
+        cout << "c Below count is NOT FULLY APPROXIMATE due to early-abort!" << endl;
+        cout << "c [appmc] Confidence of the estimate: " << confidence << endl;
+        print_num_solutions(sol_count.cellSolCount, sol_count.hashCount);
+    }
+    if (checkpoint_file != "") {
+        cout << "c [appmc] Checkpoint written to '" << checkpoint_file << "'" << endl;
+    }
+    std::cout.flush();
+    std::_Exit(-1);
+}
+
+void set_up_signals(ApproxMC::AppMC* counter, const string& checkpoint_file)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    std::thread(signal_waiter, set, counter, checkpoint_file).detach();
+}
+#endif
+
+//A checkpoint file belongs to one count. The counts of batch and server
+//mode would overwrite each other's, and all but one fail to resume
+void drop_checkpoint_options(const string& mode, Options& opt)
+{
+    if (opt.checkpoint_file != "" || opt.resume) {
+        cout << "c [appmc] WARNING: --checkpoint and --resume are ignored in "
+        << mode << " mode" << endl;
+        opt.checkpoint_file.clear();
+        opt.resume = 0;
+    }
+}
+
+//Sets up the options given on the command line
+void set_up_appmc(ApproxMC::AppMC* counter, const Options& opt, uint32_t verb)
+{
+    //Main options
+    counter->set_verbosity(verb);
+    if (verb > 2) {
+        counter->set_detach_warning();
+    }
+    counter->set_seed(opt.seed);
+    counter->set_epsilon(opt.epsilon);
+    counter->set_delta(opt.delta);
+    counter->set_num_threads(opt.num_threads);
+    counter->set_checkpoint_file(opt.checkpoint_file);
+    counter->set_resume(opt.resume);
+
+    //Improvement options
+    counter->set_detach_xors(opt.detach_xors);
+    counter->set_reuse_models(opt.reuse_models);
+    counter->set_force_sol_extension(opt.force_sol_extension);
+    counter->set_sparse(opt.sparse);
+    counter->set_fast_hit(opt.fast_hit);
+    counter->set_enum_engine(opt.enum_engine, opt.enum_confl);
+    counter->set_compact(opt.compact_lits);
+    counter->set_cube_threads(opt.cube_threads, opt.cube_vars);
+    counter->set_ind_support(opt.ind_support);
+    counter->set_ind_support_cache(opt.ind_support_cache);
+    counter->set_preprocess(opt.preprocess);
+    counter->set_preprocess_cache(opt.preprocess_cache);
+    counter->set_components(opt.components);
+    counter->set_result_cache(opt.result_cache);
+
+    //Misc options
+    counter->set_start_iter(opt.start_iter);
+    counter->set_verb_cls(opt.verb_cls);
+    counter->set_simplify(opt.simplify);
+    counter->set_var_elim_ratio(opt.var_elim_ratio);
+}
+
+////////////////////////////
+// Batch mode
+////////////////////////////
+
+bool is_directory(const string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void add_dir_contents(const string& dir, vector<string>& files)
+{
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL) {
+        std::cerr
+        << "ERROR! Could not open directory '" << dir
+        << "' for reading: " << strerror(errno) << endl;
+        std::exit(-1);
+    }
+
+    vector<string> found;
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        const string path = dir + "/" + ent->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            found.push_back(path);
+        }
+    }
+    closedir(d);
+
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}
+
+vector<string> collect_batch_inputs(const vector<string>& inputs, const string& batch_list)
+{
+    vector<string> files;
+    for (const string& in: inputs) {
+        if (is_directory(in)) {
+            add_dir_contents(in, files);
+        } else {
+            files.push_back(in);
+        }
+    }
+
+    if (!batch_list.empty()) {
+        std::ifstream list(batch_list.c_str());
+        if (!list) {
+            std::cerr
+            << "ERROR! Could not open batch list '" << batch_list
+            << "' for reading" << endl;
+            std::exit(-1);
+        }
+        string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line[0] != '#') {
+                files.push_back(line);
+            }
+        }
+    }
+
+    return files;
+}
+
+//One deque of jobs per worker. A worker takes jobs from the front of its own
+//deque and, once that is empty, steals from the back of the others.
+class BatchQueues
+{
+public:
+    BatchQueues(size_t num_workers, size_t num_jobs) :
+        queues(num_workers)
+    {
+        for (size_t i = 0; i < num_jobs; i++) {
+            queues[i % num_workers].jobs.push_back(i);
+        }
+    }
+
+    bool next_job(size_t worker, size_t& job)
+    {
+        {
+            Queue& own = queues[worker];
+            std::lock_guard<std::mutex> lock(own.mu);
+            if (!own.jobs.empty()) {
+                job = own.jobs.front();
+                own.jobs.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mu);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Queue {
+        std::mutex mu;
+        std::deque<size_t> jobs;
+    };
+    vector<Queue> queues;
+};
+
+//What the workers of one batch share
+struct Batch {
+    Batch(const Options& _opt, const vector<string>& _files, size_t num_workers) :
+        opt(_opt),
+        files(_files),
+        queues(num_workers, _files.size())
+    {}
+
+    const Options& opt;
+    const vector<string>& files;
+    BatchQueues queues;
+    std::mutex out_mutex;
+};
+
+ApproxMC::AppMC* batch_read(const Options& opt, const string& filename)
+{
+    //Per-instance output of many instances at the same time is unreadable,
+    //so they are only verbose at verbosity 2 and above
+    const uint32_t verb = opt.verbosity >= 2 ? opt.verbosity : 0;
+    ApproxMC::AppMC* counter = new ApproxMC::AppMC;
+    set_up_appmc(counter, opt, verb);
+    if (!read_in_file(counter, filename, verb)) {
+        delete counter;
+        return NULL;
+    }
+    return counter;
+}
+
+//c is NULL if the CNF could not be read or counted. With --maxtime, an
+//instance without a single finished measurement has no count
+void batch_emit(Batch* batch, const string& filename, const ApproxMC::SolCount* c
+    , const ApproxMC::Progress* last)
+{
+    std::lock_guard<std::mutex> lock(batch->out_mutex);
+    if (c == NULL || (!c->valid && batch->opt.max_time == 0)) {
+        cout << "s mc-error " << filename << endl;
+    } else if (!c->valid) {
+        cout << "s mc-timeout " << filename << endl;
+    } else {
+        if (last->measurements_done < last->measurements_total) {
+            cout << "c [appmc] " << filename
+            << ": count is NOT FULLY APPROXIMATE due to the time limit, confidence "
+            << last->confidence << endl;
+        }
+        cout << "s mc " << num_solutions_str(c->cellSolCount, c->hashCount)
+        << " " << filename << endl;
+    }
+}
+
+//Parsing of the next instance is done in the background while the current
+//one is being counted
+void batch_worker(Batch* batch, size_t worker)
+{
+    const vector<string>& files = batch->files;
+    size_t job;
+    if (!batch->queues.next_job(worker, job)) {
+        return;
+    }
+    ApproxMC::AppMC* cur = batch_read(batch->opt, files[job]);
+
+    while (true) {
+        size_t next_job;
+        const bool have_next = batch->queues.next_job(worker, next_job);
+        std::future<ApproxMC::AppMC*> next;
+        if (have_next) {
+            next = std::async(std::launch::async, batch_read
+                , std::cref(batch->opt), files[next_job]);
+        }
+
+        if (cur != NULL) {
+            try {
+                ApproxMC::Progress last;
+                const ApproxMC::SolCount c = cur->count(batch->opt.max_time
+                    , [&](const ApproxMC::Progress& prog) { last = prog; });
+                batch_emit(batch, files[job], &c, &last);
+            } catch (const ApproxMC::AppMCError& e) {
+                {
+                    std::lock_guard<std::mutex> lock(batch->out_mutex);
+                    cout << "c [appmc] ERROR: " << files[job] << ": " << e.what() << endl;
+                }
+                batch_emit(batch, files[job], NULL, NULL);
+            }
+            delete cur;
+        } else {
+            batch_emit(batch, files[job], NULL, NULL);
+        }
+
+        if (!have_next) {
+            break;
+        }
+        cur = next.get();
+        job = next_job;
+    }
+}
+
+void count_batch(const Options& opt, const vector<string>& files)
+{
+    size_t num_workers = opt.batch_jobs;
+    if (num_workers == 0) {
+        num_workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    num_workers = std::max<size_t>(1, std::min(num_workers, files.size()));
+
+    if (opt.verbosity) {
+        cout << "c [appmc] Batch mode, counting " << files.size()
+        << " CNFs with " << num_workers << " workers" << endl;
+    }
+
+    Batch batch(opt, files, num_workers);
+    vector<std::thread> threads;
+    for (size_t i = 0; i < num_workers; i++) {
+        threads.push_back(std::thread(batch_worker, &batch, i));
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+}
+
+#ifndef _WIN32
+//////////////////////////////
+// Server mode
+//
+// Clients connect to a Unix socket and send jobs as lines:
+//   count <id> [epsilon=E] [delta=D] [seed=S]
+//   <DIMACS lines>
+//   end
+// and can cancel a job with "cancel <id>". Replies are lines too:
+//   queued <id>
+//   progress <id> <done>/<total> <estimate> confidence=C wall=T
+//   result <id> <count> wall=T cpu=T measurements=<done>/<total>
+//   cancelled <id>
+//   error <id> <message>
+// Every worker keeps a counter set up ahead of time, so a job only pays
+// for parsing and counting.
+//////////////////////////////
+
+//Replies waiting to be written to one client. A thread of its own writes
+//them, so a client that does not read its socket only holds up its own
+//replies, not the workers or the other clients
+class ServerOutbox {
+public:
+    explicit ServerOutbox(int _fd) :
+        fd(_fd)
+    {}
+
+    void push(const string& data)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failed) {
+            pending.push_back(data);
+            cond.notify_one();
+        }
+    }
+
+    //The socket is closed once what was pushed so far is written
+    void close_when_done()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        cond.notify_one();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cond.wait(lock, [this]{ return !pending.empty() || closing; });
+            if (pending.empty()) {
+                break;
+            }
+            const string data = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            const bool ok = write_all(data);
+            lock.lock();
+            if (!ok) {
+                //Client went away, nothing left to tell it
+                failed = true;
+                pending.clear();
+            }
+        }
+        lock.unlock();
+        close(fd);
+    }
+
+private:
+    bool write_all(const string& data)
+    {
+        size_t at = 0;
+        while (at < data.size()) {
+            const ssize_t n = write(fd, data.data() + at, data.size() - at);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            at += n;
+        }
+        return true;
+    }
+
+    const int fd;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<string> pending;
+    bool closing = false;
+    bool failed = false;
+};
+
+//Workers counting jobs of the same client reply to it at the same time,
+//every line is queued and written in one go
+struct ServerConn {
+    explicit ServerConn(int _fd) :
+        fd(_fd),
+        outbox(std::make_shared<ServerOutbox>(_fd))
+    {
+        std::thread(&ServerOutbox::run, outbox).detach();
+    }
+    ~ServerConn()
+    {
+        outbox->close_when_done();
+    }
+
+    void send_line(const string& line)
+    {
+        outbox->push(line + "\n");
+    }
+
+    const int fd;
+    std::shared_ptr<ServerOutbox> outbox;
+};
+
+struct ServerJob {
+    string id;
+    string cnf;
+    double epsilon;
+    double delta;
+    uint32_t seed;
+    std::shared_ptr<ServerConn> conn;
+
+    //Guarded by ServerJobs' mutex
+    bool queued = false; //put on the queue, after "queued" was sent
+    bool cancelled = false;
+    ApproxMC::AppMC* counter = NULL; //set while it is being counted
+};
+
+//Jobs waiting to be counted and those being counted, by id
+class ServerJobs {
+public:
+    //Replies are sent without the lock held, so a client that does not
+    //read its socket cannot hold up the workers and the other clients
+    bool add(std::shared_ptr<ServerJob> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (jobs.count(job->id)) {
+                return false;
+            }
+            jobs[job->id] = job;
+        }
+
+        //Before a worker can take it, so no other reply comes first
+        job->conn->send_line("queued " + job->id);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!job->cancelled) {
+                job->queued = true;
+                queue.push_back(job);
+                cond.notify_one();
+                return true;
+            }
+            forget(job);
+        }
+        job->conn->send_line("cancelled " + job->id);
+        return true;
+    }
+
+    std::shared_ptr<ServerJob> next()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]{ return !queue.empty(); });
+        std::shared_ptr<ServerJob> job = queue.front();
+        queue.pop_front();
+        return job;
+    }
+
+    //Returns false if the job was cancelled before it could start
+    bool start(std::shared_ptr<ServerJob> job, ApproxMC::AppMC* counter)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (job->cancelled) {
+            forget(job);
+            return false;
+        }
+        job->counter = counter;
+        return true;
+    }
+
+    //Returns whether the job was cancelled while it was counted
+    bool finish(std::shared_ptr<ServerJob> job)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job->counter = NULL;
+        forget(job);
+        return job->cancelled;
+    }
+
+    bool cancel(const string& id)
+    {
+        std::shared_ptr<ServerJob> job;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = jobs.find(id);
+            if (it == jobs.end()) {
+                return false;
+            }
+            job = it->second;
+            job->cancelled = true;
+            if (job->counter) {
+                job->counter->interrupt();
+                return true;
+            }
+            if (!job->queued) {
+                //add() has not queued it yet, it will tell the client
+                return true;
+            }
+
+            //Still queued, nobody else will tell the client
+            queue.erase(std::remove(queue.begin(), queue.end(), job), queue.end());
+            jobs.erase(it);
+        }
+        job->conn->send_line("cancelled " + id);
+        return true;
+    }
+
+private:
+    //A cancelled job's id can be reused before its worker is done with it,
+    //so only its own entry is removed. Must be called with mutex held
+    void forget(std::shared_ptr<ServerJob> job)
+    {
+        auto it = jobs.find(job->id);
+        if (it != jobs.end() && it->second == job) {
+            jobs.erase(it);
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::shared_ptr<ServerJob>> queue;
+    std::map<string, std::shared_ptr<ServerJob>> jobs;
+};
+
+ApproxMC::AppMC* server_new_counter(const Options& opt)
+{
+    const uint32_t verb = opt.verbosity >= 2 ? opt.verbosity : 0;
+    ApproxMC::AppMC* counter = new ApproxMC::AppMC;
+    set_up_appmc(counter, opt, verb);
+    return counter;
+}
+
+bool server_parse(ApproxMC::AppMC* counter, const string& cnf, uint32_t verb)
+{
+    MmapDimacsParser parser(counter, verb);
+    const bool ok = parser.parse(cnf.data(), cnf.size());
+    if (ok) {
+        counter->set_projection_set(parser.sampling_vars);
+    }
+    return ok;
+}
+
+void server_count(std::shared_ptr<ServerJob> job, ApproxMC::AppMC* counter
+    , ServerJobs* jobs, const Options& opt)
+{
+    counter->set_epsilon(job->epsilon);
+    counter->set_delta(job->delta);
+    counter->set_seed(job->seed);
+    if (!server_parse(counter, job->cnf, opt.verbosity >= 2 ? opt.verbosity : 0)) {
+        //A job cancelled before it started was already answered
+        if (!jobs->finish(job)) {
+            job->conn->send_line("error " + job->id + " could not parse CNF");
+        }
+        return;
+    }
+    job->cnf.clear();
+    if (!jobs->start(job, counter)) {
+        return;
+    }
+
+    const double start_wall = wallTime();
+    const double start_cpu = cpuTime();
+    ApproxMC::Progress last;
+    const auto progress = [&](const ApproxMC::Progress& prog) {
+        last = prog;
+        std::ostringstream ss;
+        ss << "progress " << job->id << " " << prog.measurements_done
+        << "/" << prog.measurements_total << " "
+        << num_solutions_str(prog.estimate.cellSolCount, prog.estimate.hashCount)
+        << std::fixed << std::setprecision(3)
+        << " confidence=" << prog.confidence
+        << " wall=" << prog.wall_time;
+        job->conn->send_line(ss.str());
+    };
+    ApproxMC::SolCount c;
+    try {
+        c = counter->count(0, progress);
+    } catch (const ApproxMC::AppMCError& e) {
+        jobs->finish(job);
+        job->conn->send_line("error " + job->id + " " + e.what());
+        return;
+    }
+    if (jobs->finish(job)) {
+        job->conn->send_line("cancelled " + job->id);
+        return;
+    }
+
+    std::ostringstream ss;
+    ss << "result " << job->id << " " << num_solutions_str(c.cellSolCount, c.hashCount)
+    << std::fixed << std::setprecision(3)
+    << " wall=" << wallTime() - start_wall
+    << " cpu=" << cpuTime() - start_cpu
+    << " measurements=" << last.measurements_done << "/" << last.measurements_total;
+    job->conn->send_line(ss.str());
+}
+
+void server_worker(ServerJobs* jobs, const Options* opt)
+{
+    ApproxMC::AppMC* warm = server_new_counter(*opt);
+    while (true) {
+        std::shared_ptr<ServerJob> job = jobs->next();
+        server_count(job, warm, jobs, *opt);
+        delete warm;
+        warm = server_new_counter(*opt);
+    }
+}
+
+//Parses "count <id> [epsilon=E] [delta=D] [seed=S]"
+std::shared_ptr<ServerJob> server_parse_header(std::istringstream& ss, string& err
+    , const Options& opt)
+{
+    std::shared_ptr<ServerJob> job = std::make_shared<ServerJob>();
+    job->epsilon = opt.epsilon;
+    job->delta = opt.delta;
+    job->seed = opt.seed;
+    if (!(ss >> job->id)) {
+        err = "missing job id";
+        return NULL;
+    }
+
+    string arg;
+    while (ss >> arg) {
+        const size_t eq = arg.find('=');
+        const string key = arg.substr(0, eq);
+        std::istringstream val(eq == string::npos ? "" : arg.substr(eq+1));
+        bool ok;
+        if (key == "epsilon") {
+            ok = (bool)(val >> job->epsilon) && job->epsilon >= 0;
+        } else if (key == "delta") {
+            ok = (bool)(val >> job->delta) && job->delta > 0 && job->delta <= 1;
+        } else if (key == "seed") {
+            ok = (bool)(val >> job->seed);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            err = "bad option '" + arg + "'";
+            return NULL;
+        }
+    }
+    return job;
+}
+
+void server_client(std::shared_ptr<ServerConn> conn, ServerJobs* jobs, const Options* opt)
+{
+    std::shared_ptr<ServerJob> reading; //job whose CNF is being sent
+    string pending;
+    char buf[1 << 16];
+    while (true) {
+        const ssize_t n = read(conn->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        pending.append(buf, n);
+
+        size_t start = 0;
+        size_t end;
+        while ((end = pending.find('\n', start)) != string::npos) {
+            const string line = pending.substr(start, end - start);
+            start = end + 1;
+
+            if (reading) {
+                if (line != "end") {
+                    reading->cnf += line;
+                    reading->cnf += '\n';
+                } else if (jobs->add(reading)) {
+                    reading = NULL;
+                } else {
+                    conn->send_line("error " + reading->id + " job id already in use");
+                    reading = NULL;
+                }
+                continue;
+            }
+
+            std::istringstream ss(line);
+            string cmd;
+            ss >> cmd;
+            if (cmd == "count") {
+                string err;
+                reading = server_parse_header(ss, err, *opt);
+                if (!reading) {
+                    //Its CNF will not be understood either, so this client
+                    //cannot be talked to any more
+                    conn->send_line("error - " + err);
+                    return;
+                }
+                reading->conn = conn;
+            } else if (cmd == "cancel") {
+                string id;
+                ss >> id;
+                if (!jobs->cancel(id)) {
+                    conn->send_line("error " + id + " no such job");
+                }
+            } else if (cmd == "quit") {
+                return;
+            } else if (!cmd.empty()) {
+                conn->send_line("error - unknown command '" + cmd + "'");
+            }
+        }
+        pending.erase(0, start);
+    }
+}
+
+int run_server(const Options& opt)
+{
+    const string& path = opt.server_socket;
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cout << "[appmc] ERROR: socket path '" << path << "' is too long" << endl;
+        return -1;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (fd < 0
+        || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(fd, 64) != 0
+    ) {
+        cout << "[appmc] ERROR: could not listen on '" << path << "': "
+        << strerror(errno) << endl;
+        return -1;
+    }
+
+    //Clients that go away must not take the server with them
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t num_workers = opt.batch_jobs;
+    if (num_workers == 0) {
+        num_workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    if (opt.verbosity) {
+        cout << "c [appmc] Serving on '" << path << "' with "
+        << num_workers << " workers" << endl;
+    }
+
+    ServerJobs jobs;
+    for (size_t i = 0; i < num_workers; i++) {
+        std::thread(server_worker, &jobs, &opt).detach();
+    }
+    while (true) {
+        const int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            cout << "[appmc] ERROR: accept failed: " << strerror(errno) << endl;
+            return -1;
+        }
+        std::thread(server_client, std::make_shared<ServerConn>(client), &jobs, &opt).detach();
+    }
+}
+#endif
+
+//Literals of --marginals, as given or all of the sampling set
+vector<CMSat::Lit> parse_marginals(const ApproxMC::AppMC* counter, const string& marginals)
+{
+    vector<CMSat::Lit> lits;
+    if (marginals == "ind") {
+        for (const uint32_t v: counter->get_sampling_set()) {
+            lits.push_back(CMSat::Lit(v, false));
+        }
+        return lits;
+    }
+
+    std::stringstream ss(marginals);
+    string tok;
+    while (std::getline(ss, tok, ',')) {
+        char* end;
+        const long lit = strtol(tok.c_str(), &end, 10);
+        if (tok.empty() || *end != '\0' || lit == 0) {
+            cout << "[appmc] ERROR: '" << tok << "' in --marginals is not a literal" << endl;
+            exit(-1);
+        }
+        lits.push_back(CMSat::Lit(std::labs(lit)-1, lit < 0));
+    }
+    return lits;
+}
+
+void count_marginals(ApproxMC::AppMC* appmc, const string& marginals)
+{
+    if (marginals == "ind" && appmc->get_sampling_set().empty()) {
+        vector<uint32_t> all;
+        for (uint32_t i = 0; i < appmc->nVars(); i++) {
+            all.push_back(i);
+        }
+        appmc->set_projection_set(all);
+    }
+
+    const vector<CMSat::Lit> lits = parse_marginals(appmc, marginals);
+    const vector<ApproxMC::SolCount> counts = appmc->count_marginals(lits);
+    for (size_t i = 0; i < lits.size(); i++) {
+        const ApproxMC::SolCount& c = counts[i];
+        cout << "s mc-marginal " << lits[i] << " ";
+        if (c.valid) {
+            cout << num_solutions_str(c.cellSolCount, c.hashCount);
+        } else {
+            cout << "unknown";
+        }
+        cout << endl;
+    }
 }
 
 int main(int argc, char** argv)
@@ -334,8 +1333,6 @@ int main(int argc, char** argv)
                    FE_OVERFLOW
                   );
     #endif
-//     signal(SIGALRM, SIGINT_handler);
-//     signal(SIGTERM, SIGINT_handler);
 
     //Reconstruct the command line so we can emit it later if needed
     string command_line;
@@ -346,51 +1343,92 @@ int main(int argc, char** argv)
         }
     }
 
-    appmc = new ApproxMC::AppMC;
-    add_supported_options(argc, argv);
-    if (verbosity) {
+    Options opt;
+    po::variables_map vm;
+    add_supported_options(argc, argv, opt, vm);
+    ApproxMC::AppMC* appmc = new ApproxMC::AppMC;
+    if (opt.verbosity) {
         cout << appmc->get_version_info();
         cout << "c executed with command line: " << command_line << endl;
     }
 
-    //Main options
-    appmc->set_verbosity(verbosity);
-    if (verbosity > 2) {
-        appmc->set_detach_warning();
+    if (!opt.server_socket.empty()) {
+        #ifndef _WIN32
+        drop_checkpoint_options("server", opt);
+        return run_server(opt);
+        #else
+        cout << "[appmc] ERROR: server mode needs Unix sockets" << endl;
+        exit(-1);
+        #endif
     }
-    appmc->set_seed(seed);
-    appmc->set_epsilon(epsilon);
-    appmc->set_delta(delta);
-
-    //Improvement options
-    appmc->set_detach_xors(detach_xors);
-    appmc->set_reuse_models(reuse_models);
-    appmc->set_force_sol_extension(force_sol_extension);
-    appmc->set_sparse(sparse);
 
-    //Misc options
-    appmc->set_start_iter(start_iter);
-    appmc->set_verb_cls(verb_cls);
-    appmc->set_simplify(simplify);
-    appmc->set_var_elim_ratio(var_elim_ratio);
+    vector<string> inp;
+    if (vm.count("input") != 0) {
+        inp = vm["input"].as<vector<string> >();
+    }
+    if (inp.size() > 1 || !opt.batch_list.empty()
+        || (inp.size() == 1 && is_directory(inp[0]))
+    ) {
+        if (opt.logfilename != "") {
+            cout << "c [appmc] WARNING: --log is ignored in batch mode" << endl;
+        }
+        drop_checkpoint_options("batch", opt);
+        count_batch(opt, collect_batch_inputs(inp, opt.batch_list));
+        delete appmc;
+        return 0;
+    }
 
-    if (logfilename != "") {
-        appmc->set_up_log(logfilename);
-        cout << "c [appmc] Logfile set " << logfilename << endl;
+    #ifndef _WIN32
+    set_up_signals(appmc, opt.checkpoint_file);
+    #endif
+    set_up_appmc(appmc, opt, opt.verbosity);
+    if (opt.logfilename != "") {
+        appmc->set_up_log(opt.logfilename);
+        cout << "c [appmc] Logfile set " << opt.logfilename << endl;
     }
 
-    if (vm.count("input") != 0) {
-        vector<string> inp = vm["input"].as<vector<string> >();
-        if (inp.size() > 1) {
-            cout << "[appmc] ERROR: you must only give one CNF as input" << endl;
+    if (!inp.empty()) {
+        if (!read_in_file(appmc, inp[0], opt.verbosity)) {
             exit(-1);
         }
-        read_in_file(inp[0].c_str());
     } else {
-        read_stdin();
+        read_stdin(appmc, opt.verbosity);
     }
 
-    auto sol_count = appmc->count();
+    ApproxMC::Progress last;
+    const auto progress = [&](const ApproxMC::Progress& prog) {
+        last = prog;
+        if (opt.verbosity) {
+            std::ostringstream ss;
+            ss << "c [appmc] Progress: " << prog.measurements_done << "/"
+            << prog.measurements_total << " measurements, estimate "
+            << num_solutions_str(prog.estimate.cellSolCount, prog.estimate.hashCount)
+            << " confidence " << std::setprecision(3) << prog.confidence
+            << " T: " << std::setprecision(2) << std::fixed << prog.wall_time << " s";
+            cout << ss.str() << endl;
+        }
+    };
+    ApproxMC::SolCount sol_count;
+    try {
+        if (!opt.marginals.empty()) {
+            count_marginals(appmc, opt.marginals);
+            delete appmc;
+            return 0;
+        }
+        sol_count = appmc->count(opt.max_time, progress);
+    } catch (const ApproxMC::AppMCError& e) {
+        cout << "[appmc] ERROR: " << e.what() << endl;
+        exit(-1);
+    }
+    if (!sol_count.valid) {
+        cout << "c did not manage to get a single measurement, we have no estimate of the count" << endl;
+        delete appmc;
+        return -1;
+    }
+    if (last.measurements_done < last.measurements_total) {
+        cout << "c Below count is NOT FULLY APPROXIMATE due to the time limit!" << endl;
+        cout << "c [appmc] Confidence of the estimate: " << last.confidence << endl;
+    }
     print_num_solutions(sol_count.cellSolCount, sol_count.hashCount);
     delete appmc;
 }
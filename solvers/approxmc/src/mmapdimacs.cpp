@@ -0,0 +1,377 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "mmapdimacs.h"
+#include "counter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using CMSat::Lit;
+
+//Same limit as CMS' DimacsParser
+static const uint64_t max_var_num = 1ULL << 28;
+
+//Clauses are handed over once this many literals are waiting
+static const size_t bulk_lits = 1 << 16;
+
+//Character classes, so the scanner does a single lookup per byte
+enum : uint8_t {cls_other = 0, cls_blank = 1, cls_newline = 2, cls_digit = 4};
+
+struct CharClasses {
+    CharClasses()
+    {
+        memset(cls, cls_other, sizeof(cls));
+        cls[(uint8_t)' '] = cls_blank;
+        cls[(uint8_t)'\t'] = cls_blank;
+        cls[(uint8_t)'\r'] = cls_blank;
+        cls[(uint8_t)'\v'] = cls_blank;
+        cls[(uint8_t)'\f'] = cls_blank;
+        cls[(uint8_t)'\n'] = cls_newline;
+        for (char c = '0'; c <= '9'; c++) {
+            cls[(uint8_t)c] = cls_digit;
+        }
+    }
+    uint8_t cls[256];
+};
+static const CharClasses classes;
+
+static inline uint8_t char_class(const char c)
+{
+    return classes.cls[(uint8_t)c];
+}
+
+MmapDimacsParser::MmapDimacsParser(ApproxMC::AppMC* _counter, uint32_t _verbosity) :
+    counter(_counter),
+    verbosity(_verbosity)
+{}
+
+MmapDimacsParser::MmapDimacsParser(InputFormula* _formula, uint32_t _verbosity) :
+    formula(_formula),
+    verbosity(_verbosity)
+{}
+
+MmapDimacsParser::~MmapDimacsParser()
+{
+    #ifndef _WIN32
+    if (mapped) {
+        munmap(mapped, mapped_size);
+    }
+    #endif
+}
+
+bool MmapDimacsParser::map_file(const string& filename)
+{
+    #ifdef _WIN32
+    (void)filename;
+    return false;
+    #else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    mapped_size = st.st_size;
+    if (mapped_size == 0) {
+        //Nothing to map, but an empty file is still a valid CNF
+        close(fd);
+        return true;
+    }
+    void* m = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        mapped_size = 0;
+        return false;
+    }
+    #ifdef MADV_SEQUENTIAL
+    madvise(m, mapped_size, MADV_SEQUENTIAL);
+    #endif
+
+    //Gzipped files are left to the stream parser
+    const unsigned char* bytes = (const unsigned char*)m;
+    if (mapped_size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+        munmap(m, mapped_size);
+        mapped_size = 0;
+        return false;
+    }
+    mapped = m;
+    return true;
+    #endif
+}
+
+bool MmapDimacsParser::parse_mapped()
+{
+    return parse((const char*)mapped, mapped_size);
+}
+
+bool MmapDimacsParser::parse(const char* data, size_t size)
+{
+    at = data;
+    end = data + size;
+    line_num = 1;
+
+    while (true) {
+        //Skip empty lines and leading blanks
+        while (at < end && char_class(*at) & (cls_blank | cls_newline)) {
+            line_num += *at == '\n';
+            at++;
+        }
+        if (at == end) {
+            break;
+        }
+
+        bool ok;
+        switch (*at) {
+            case 'c':
+                ok = parse_comment();
+                break;
+            case 'p':
+                ok = parse_header();
+                break;
+            case 'x':
+                ok = parse_xor();
+                break;
+            default:
+                ok = parse_clause();
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    flush_clauses();
+
+    if (verbosity) {
+        cout << "c [appmc] Parsed " << num_clauses << " clauses and "
+        << num_xors << " XORs" << endl;
+    }
+    return true;
+}
+
+bool MmapDimacsParser::error(const string& what)
+{
+    cerr << "PARSE ERROR! " << what << " At line " << line_num << endl;
+    return false;
+}
+
+void MmapDimacsParser::skip_line()
+{
+    const void* nl = memchr(at, '\n', end - at);
+    at = nl ? (const char*)nl : end;
+}
+
+//Reads a signed integer, skipping blanks and line ends before it
+bool MmapDimacsParser::read_lit(int64_t& lit)
+{
+    while (at < end && char_class(*at) & (cls_blank | cls_newline)) {
+        line_num += *at == '\n';
+        at++;
+    }
+    const bool neg = at < end && *at == '-';
+    at += neg;
+    if (at == end || char_class(*at) != cls_digit) {
+        return false;
+    }
+
+    uint64_t val = 0;
+    while (at < end && char_class(*at) == cls_digit) {
+        val = val*10 + (*at - '0');
+        at++;
+        if (val > max_var_num) {
+            return false;
+        }
+    }
+    lit = neg ? -(int64_t)val : (int64_t)val;
+    return true;
+}
+
+void MmapDimacsParser::make_vars(uint64_t num)
+{
+    if (formula) {
+        if (num > formula->num_vars) {
+            formula->num_vars = num;
+        }
+        return;
+    }
+    if (num > counter->nVars()) {
+        counter->new_vars(num - counter->nVars());
+    }
+}
+
+void MmapDimacsParser::flush_clauses()
+{
+    if (lits.empty()) {
+        return;
+    }
+    make_vars(num_vars);
+    if (formula) {
+        vector<Lit> cl;
+        for (const Lit l: lits) {
+            if (l != CMSat::lit_Undef) {
+                cl.push_back(l);
+                continue;
+            }
+            formula->clauses.push_back(cl);
+            cl.clear();
+        }
+    } else {
+        counter->add_clauses(lits);
+    }
+    lits.clear();
+}
+
+bool MmapDimacsParser::parse_header()
+{
+    at++;
+    while (at < end && char_class(*at) == cls_blank) {
+        at++;
+    }
+    if (end - at < 3 || memcmp(at, "cnf", 3) != 0) {
+        return error("Expected 'p cnf' header.");
+    }
+    at += 3;
+
+    int64_t vars;
+    int64_t cls;
+    if (!read_lit(vars) || !read_lit(cls) || vars < 0 || cls < 0) {
+        return error("Bad 'p cnf' header.");
+    }
+    make_vars(vars);
+    skip_line();
+    return true;
+}
+
+bool MmapDimacsParser::parse_comment()
+{
+    at++;
+    while (at < end && char_class(*at) == cls_blank) {
+        at++;
+    }
+
+    if (end - at >= 4 && memcmp(at, "ind", 3) == 0
+        && char_class(at[3]) == cls_blank
+    ) {
+        at += 3;
+        while (true) {
+            while (at < end && char_class(*at) == cls_blank) {
+                at++;
+            }
+            if (at == end || *at == '\n') {
+                break;
+            }
+            int64_t var;
+            if (!read_lit(var) || var < 0) {
+                return error("Bad 'c ind' line.");
+            }
+            if (var == 0) {
+                break;
+            }
+            make_vars(var);
+            sampling_vars.push_back(var-1);
+        }
+        skip_line();
+        return true;
+    }
+    skip_line();
+    return true;
+}
+
+bool MmapDimacsParser::parse_clause()
+{
+    int64_t lit;
+    while (true) {
+        if (!read_lit(lit)) {
+            if (at == end) {
+                return error("Clause not terminated with 0.");
+            }
+            return error(string("Unexpected character '") + *at + "'.");
+        }
+        if (lit == 0) {
+            break;
+        }
+        const uint64_t var = std::abs(lit) - 1;
+        num_vars = std::max(num_vars, var+1);
+        lits.push_back(Lit(var, lit < 0));
+    }
+    lits.push_back(CMSat::lit_Undef);
+    num_clauses++;
+
+    if (lits.size() >= bulk_lits) {
+        flush_clauses();
+    }
+    return true;
+}
+
+//"x1 2 -3 0" is the XOR of vars 1, 2 and 3 being false
+bool MmapDimacsParser::parse_xor()
+{
+    at++;
+    vector<uint32_t> vars;
+    bool rhs = true;
+    int64_t lit;
+    while (true) {
+        if (!read_lit(lit)) {
+            return error("Bad XOR clause.");
+        }
+        if (lit == 0) {
+            break;
+        }
+        rhs ^= lit < 0;
+        vars.push_back(std::abs(lit) - 1);
+        num_vars = std::max<uint64_t>(num_vars, vars.back()+1);
+    }
+
+    //Keep the order of clauses and XORs
+    flush_clauses();
+    make_vars(num_vars);
+    if (formula) {
+        formula->xors.push_back(std::make_pair(vars, rhs));
+    } else {
+        counter->add_xor_clause(vars, rhs);
+    }
+    num_xors++;
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef MMAPDIMACS_H_
+#define MMAPDIMACS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "approxmc.h"
+
+struct InputFormula;
+
+//DIMACS parser working straight on the bytes of a memory-mapped file (or
+//any buffer), handing clauses to the counter in bulk. Understands the
+//"c ind" projection lines and "x" XOR lines, other comments are skipped.
+//Gzipped files and standard input still go through CMS' DimacsParser.
+class MmapDimacsParser {
+public:
+    MmapDimacsParser(ApproxMC::AppMC* counter, uint32_t verbosity);
+    //Reads into 'formula' instead of a counter, for code that drives a
+    //Counter directly, like the microbenchmarks
+    MmapDimacsParser(InputFormula* formula, uint32_t verbosity);
+
+    //Returns false if the file could not be mapped, in which case nothing
+    //was added to the counter
+    bool map_file(const std::string& filename);
+    bool parse_mapped();
+    bool parse(const char* data, size_t size);
+    ~MmapDimacsParser();
+
+    std::vector<uint32_t> sampling_vars;
+
+private:
+    bool parse_header();
+    bool parse_comment();
+    bool parse_clause();
+    bool parse_xor();
+    bool read_lit(int64_t& lit);
+    void skip_line();
+    void flush_clauses();
+    void make_vars(uint64_t num);
+    bool error(const std::string& what);
+
+    ApproxMC::AppMC* counter = NULL;
+    InputFormula* formula = NULL;
+    const uint32_t verbosity;
+
+    const char* at = NULL;
+    const char* end = NULL;
+    uint64_t line_num = 1;
+
+    //Clauses waiting to be added, separated by lit_Undef
+    std::vector<CMSat::Lit> lits;
+    uint64_t num_vars = 0; //needed by the literals seen so far
+    uint64_t num_clauses = 0;
+    uint64_t num_xors = 0;
+
+    //The mapping, if it's a file we mapped
+    void* mapped = NULL;
+    size_t mapped_size = 0;
+};
+
+#endif //MMAPDIMACS_H_
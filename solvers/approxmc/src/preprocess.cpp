@@ -0,0 +1,620 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "preprocess.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include "bcnf.h"
+#include "indsupport.h"
+#include "time_mem.h"
+#include "tmpname.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+using namespace CMSat;
+
+//Limits of variable elimination, so it stays cheap on large formulas
+static const uint64_t max_elim_pairs = 400; //positive*negative occurrences
+static const size_t max_resolvent_size = 25;
+
+Preprocessor::Preprocessor(
+    const InputFormula& _in, const vector<uint32_t>& _sampling_set, uint32_t verbosity) :
+    in(_in),
+    sampling_set(_sampling_set),
+    verb(verbosity),
+    in_sampling(_in.num_vars, 0),
+    in_xor(_in.num_vars, 0),
+    occ(2*_in.num_vars),
+    xors(_in.xors),
+    value(_in.num_vars, l_Undef),
+    gone(_in.num_vars, 0)
+{
+    for (const uint32_t v: sampling_set) {
+        in_sampling[v] = 1;
+    }
+    for (const auto& x: in.xors) {
+        for (const uint32_t v: x.first) {
+            in_xor[v] = 1;
+        }
+    }
+}
+
+void Preprocessor::add_clause(const vector<Lit>& cl)
+{
+    for (const Lit l: cl) {
+        occ[l.toInt()].push_back(clauses.size());
+    }
+    clauses.push_back(cl);
+    deleted.push_back(0);
+}
+
+//Removes duplicate literals, returns false if the clause is a tautology
+static bool normalise(vector<Lit>& cl)
+{
+    std::sort(cl.begin(), cl.end());
+    size_t j = 0;
+    for (size_t i = 0; i < cl.size(); i++) {
+        if (j > 0 && cl[j-1] == cl[i]) {
+            continue;
+        }
+        if (j > 0 && cl[j-1] == ~cl[i]) {
+            return false;
+        }
+        cl[j++] = cl[i];
+    }
+    cl.resize(j);
+    return true;
+}
+
+bool Preprocessor::run()
+{
+    const double start_time = cpuTime();
+    vector<Lit> cl;
+    for (const auto& c: in.clauses) {
+        cl = c;
+        if (normalise(cl)) {
+            add_clause(cl);
+        }
+    }
+
+    bool sat = true;
+    for (uint32_t round = 0; round < 5 && sat; round++) {
+        const size_t units_before = units.size();
+        const size_t equivs_before = equivs.size();
+        const size_t elims_before = elims.size();
+        sat = propagate() && substitute_equivs() && propagate() && eliminate();
+        if (units.size() == units_before
+            && equivs.size() == equivs_before
+            && elims.size() == elims_before
+        ) {
+            break;
+        }
+    }
+    if (sat) {
+        sat = propagate();
+    }
+    finish(sat);
+
+    if (verb) {
+        cout << "c [appmc] Preprocessing fixed " << units.size()
+        << " substituted " << equivs.size()
+        << " eliminated " << elims.size() << " variables,"
+        << " clauses: " << in.clauses.size() << " -> " << formula.clauses.size()
+        << " T: " << std::setprecision(2) << std::fixed
+        << (cpuTime() - start_time) << endl;
+    }
+    return sat;
+}
+
+bool Preprocessor::propagate()
+{
+    bool changed = true;
+    vector<Lit> cl;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < clauses.size(); i++) {
+            if (deleted[i]) {
+                continue;
+            }
+            cl.clear();
+            bool sat = false;
+            for (const Lit l: clauses[i]) {
+                const lbool val = value[l.var()];
+                if (val == l_Undef) {
+                    cl.push_back(l);
+                } else if ((val == l_True) ^ l.sign()) {
+                    sat = true;
+                    break;
+                }
+            }
+            if (sat) {
+                deleted[i] = 1;
+                continue;
+            }
+            if (cl.empty()) {
+                return false;
+            }
+            if (cl.size() == 1) {
+                const Lit u = cl[0];
+                value[u.var()] = u.sign() ? l_False : l_True;
+                if (!in_sampling[u.var()]) {
+                    units.push_back(u);
+                }
+                deleted[i] = 1;
+                changed = true;
+                continue;
+            }
+            //occ lists may keep this clause under the removed literals,
+            //users check the clause still has the literal
+            clauses[i] = cl;
+        }
+
+        for (auto& x: xors) {
+            vector<uint32_t> vars;
+            for (const uint32_t v: x.first) {
+                if (value[v] == l_Undef) {
+                    vars.push_back(v);
+                } else {
+                    x.second ^= value[v] == l_True;
+                }
+            }
+            x.first = vars;
+            if (vars.empty() && x.second) {
+                return false;
+            }
+            if (vars.size() == 1) {
+                const uint32_t v = vars[0];
+                value[v] = x.second ? l_True : l_False;
+                if (!in_sampling[v]) {
+                    units.push_back(Lit(v, !x.second));
+                }
+                x.first.clear();
+                x.second = false;
+                changed = true;
+            }
+        }
+    }
+    return true;
+}
+
+//Tarjan's algorithm on the implication graph of the binary clauses,
+//without recursion. Literals in one component are equivalent
+bool Preprocessor::substitute_equivs()
+{
+    const uint32_t n = 2*in.num_vars;
+    vector<vector<uint32_t>> graph(n);
+    for (size_t i = 0; i < clauses.size(); i++) {
+        if (deleted[i] || clauses[i].size() != 2) {
+            continue;
+        }
+        const Lit a = clauses[i][0];
+        const Lit b = clauses[i][1];
+        graph[(~a).toInt()].push_back(b.toInt());
+        graph[(~b).toInt()].push_back(a.toInt());
+    }
+
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    vector<uint32_t> index(n, none);
+    vector<uint32_t> low(n, 0);
+    vector<char> on_stack(n, 0);
+    vector<uint32_t> stack;
+    vector<std::pair<uint32_t, size_t>> work; //node, next edge
+    vector<Lit> repl(in.num_vars, lit_Undef);
+    uint32_t next_index = 0;
+    bool found = false;
+
+    for (uint32_t start = 0; start < n; start++) {
+        if (index[start] != none || graph[start].empty()) {
+            continue;
+        }
+        work.push_back(std::make_pair(start, 0));
+        index[start] = low[start] = next_index++;
+        stack.push_back(start);
+        on_stack[start] = 1;
+        while (!work.empty()) {
+            const uint32_t node = work.back().first;
+            size_t& edge = work.back().second;
+            if (edge < graph[node].size()) {
+                const uint32_t to = graph[node][edge++];
+                if (index[to] == none) {
+                    index[to] = low[to] = next_index++;
+                    stack.push_back(to);
+                    on_stack[to] = 1;
+                    work.push_back(std::make_pair(to, 0));
+                } else if (on_stack[to]) {
+                    low[node] = std::min(low[node], index[to]);
+                }
+                continue;
+            }
+
+            work.pop_back();
+            if (!work.empty()) {
+                const uint32_t up = work.back().first;
+                low[up] = std::min(low[up], low[node]);
+            }
+            if (low[node] != index[node]) {
+                continue;
+            }
+
+            vector<Lit> comp;
+            uint32_t x;
+            do {
+                x = stack.back();
+                stack.pop_back();
+                on_stack[x] = 0;
+                comp.push_back(Lit::toLit(x));
+            } while (x != node);
+            if (comp.size() < 2) {
+                continue;
+            }
+
+            //Sampling variables are kept, the smallest one if any
+            Lit rep = comp[0];
+            for (const Lit l: comp) {
+                const bool l_s = in_sampling[l.var()];
+                const bool r_s = in_sampling[rep.var()];
+                if ((l_s && !r_s) || (l_s == r_s && l.var() < rep.var())) {
+                    rep = l;
+                }
+            }
+            for (const Lit l: comp) {
+                if (l == ~rep) {
+                    return false;
+                }
+                if (l.var() == rep.var() || in_sampling[l.var()] || in_xor[l.var()]
+                    || gone[l.var()] || repl[l.var()] != lit_Undef
+                ) {
+                    continue;
+                }
+                repl[l.var()] = rep ^ l.sign();
+                found = true;
+            }
+        }
+    }
+    if (!found) {
+        return true;
+    }
+
+    //The representative of a component is never replaced itself
+    for (uint32_t v = 0; v < in.num_vars; v++) {
+        if (repl[v] != lit_Undef) {
+            gone[v] = 1;
+            equivs.push_back(std::make_pair(v, repl[v]));
+        }
+    }
+    vector<vector<Lit>> old;
+    for (size_t i = 0; i < clauses.size(); i++) {
+        if (!deleted[i]) {
+            old.push_back(clauses[i]);
+        }
+    }
+    clauses.clear();
+    deleted.clear();
+    for (auto& o: occ) {
+        o.clear();
+    }
+    for (auto& cl: old) {
+        for (Lit& l: cl) {
+            if (repl[l.var()] != lit_Undef) {
+                l = repl[l.var()] ^ l.sign();
+            }
+        }
+        if (normalise(cl)) {
+            add_clause(cl);
+        }
+    }
+    return true;
+}
+
+bool Preprocessor::eliminate()
+{
+    vector<uint32_t> order;
+    for (uint32_t v = 0; v < in.num_vars; v++) {
+        if (!in_sampling[v] && !in_xor[v] && !gone[v] && value[v] == l_Undef) {
+            order.push_back(v);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return occ[2*a].size() + occ[2*a+1].size() < occ[2*b].size() + occ[2*b+1].size();
+    });
+    for (const uint32_t v: order) {
+        if (!eliminate_var(v)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Returns false if an empty resolvent was found
+bool Preprocessor::eliminate_var(const uint32_t v)
+{
+    vector<uint32_t> sides[2];
+    for (uint32_t sign = 0; sign < 2; sign++) {
+        const Lit l(v, sign);
+        for (const uint32_t at: occ[l.toInt()]) {
+            if (!deleted[at]
+                && std::find(clauses[at].begin(), clauses[at].end(), l) != clauses[at].end()
+                && std::find(sides[sign].begin(), sides[sign].end(), at) == sides[sign].end()
+            ) {
+                sides[sign].push_back(at);
+            }
+        }
+    }
+    const vector<uint32_t>& pos = sides[0];
+    const vector<uint32_t>& neg = sides[1];
+    if (pos.empty() && neg.empty()) {
+        return true;
+    }
+    if ((uint64_t)pos.size()*neg.size() > max_elim_pairs) {
+        return true;
+    }
+
+    vector<vector<Lit>> resolvents;
+    vector<Lit> r;
+    for (const uint32_t p: pos) {
+        for (const uint32_t q: neg) {
+            r.clear();
+            for (const Lit l: clauses[p]) {
+                if (l.var() != v) {
+                    r.push_back(l);
+                }
+            }
+            for (const Lit l: clauses[q]) {
+                if (l.var() != v) {
+                    r.push_back(l);
+                }
+            }
+            if (!normalise(r)) {
+                continue;
+            }
+            if (r.size() > max_resolvent_size) {
+                return true;
+            }
+            resolvents.push_back(r);
+            if (resolvents.size() > pos.size() + neg.size()) {
+                return true;
+            }
+        }
+    }
+
+    vector<vector<Lit>> removed;
+    for (const uint32_t at: pos) {
+        removed.push_back(clauses[at]);
+        deleted[at] = 1;
+    }
+    for (const uint32_t at: neg) {
+        removed.push_back(clauses[at]);
+        deleted[at] = 1;
+    }
+    elims.push_back(std::make_pair(v, removed));
+    gone[v] = 1;
+    for (const auto& res: resolvents) {
+        if (res.empty()) {
+            return false;
+        }
+        add_clause(res);
+    }
+    return true;
+}
+
+void Preprocessor::finish(bool sat)
+{
+    formula = InputFormula();
+    formula.num_vars = in.num_vars;
+    if (!sat) {
+        formula.clauses.push_back(vector<Lit>());
+        return;
+    }
+    for (const uint32_t v: sampling_set) {
+        if (value[v] != l_Undef) {
+            formula.clauses.push_back(vector<Lit>{Lit(v, value[v] == l_False)});
+        }
+    }
+    for (size_t i = 0; i < clauses.size(); i++) {
+        if (!deleted[i]) {
+            formula.clauses.push_back(clauses[i]);
+        }
+    }
+    for (const auto& x: xors) {
+        if (!x.first.empty()) {
+            formula.xors.push_back(x);
+        }
+    }
+}
+
+vector<uint32_t> Preprocessor::removed_vars() const
+{
+    vector<uint32_t> ret;
+    for (const Lit l: units) {
+        ret.push_back(l.var());
+    }
+    for (const auto& e: equivs) {
+        ret.push_back(e.first);
+    }
+    for (const auto& e: elims) {
+        ret.push_back(e.first);
+    }
+    return ret;
+}
+
+string Preprocessor::cache_name(const string& dir) const
+{
+    vector<uint32_t> sampl = sampling_set;
+    std::sort(sampl.begin(), sampl.end());
+    uint64_t h = IndSupport::fingerprint(in);
+    h = bcnf_fnv1a(h, sampl.data(), sampl.size()*sizeof(uint32_t));
+
+    std::stringstream ss;
+    ss << dir << "/" << std::hex << std::setw(16) << std::setfill('0')
+    << h << ".pre";
+    return ss.str();
+}
+
+static void write_lits(std::ostream& out, const vector<Lit>& lits)
+{
+    for (const Lit l: lits) {
+        out << (l.sign() ? "-" : "") << l.var()+1 << " ";
+    }
+    out << "0" << endl;
+}
+
+static bool read_lits(std::istream& in, const uint32_t num_vars, vector<Lit>& lits)
+{
+    lits.clear();
+    int64_t l;
+    while (in >> l && l != 0) {
+        if (std::llabs(l) > num_vars) {
+            return false;
+        }
+        lits.push_back(Lit(std::llabs(l)-1, l < 0));
+    }
+    return (bool)in;
+}
+
+//A DIMACS file of the reduced formula, with the reconstruction map in
+//comment lines before the header
+void Preprocessor::write_cache(const string& dir) const
+{
+    const string name = cache_name(dir);
+    const string tmp_name = tmp_file_name(name);
+    std::ofstream f(tmp_name.c_str());
+    f << "c approxmc-preprocessed " << in.num_vars << endl;
+    f << "c unit ";
+    write_lits(f, units);
+    for (const auto& e: equivs) {
+        f << "c equiv " << e.first+1 << " ";
+        write_lits(f, vector<Lit>{e.second});
+    }
+    for (const auto& e: elims) {
+        f << "c elim " << e.first+1 << " " << e.second.size() << endl;
+        for (const auto& cl: e.second) {
+            f << "c elimcl ";
+            write_lits(f, cl);
+        }
+    }
+    f << "p cnf " << formula.num_vars << " "
+    << formula.clauses.size() + formula.xors.size() << endl;
+    for (const auto& cl: formula.clauses) {
+        write_lits(f, cl);
+    }
+    for (const auto& x: formula.xors) {
+        f << "x";
+        for (size_t i = 0; i < x.first.size(); i++) {
+            f << ((i == 0 && !x.second) ? "-" : "") << x.first[i]+1 << " ";
+        }
+        f << "0" << endl;
+    }
+    f.close();
+
+    if (!f || std::rename(tmp_name.c_str(), name.c_str()) != 0) {
+        cout << "c [appmc] WARNING: could not write preprocessing cache '"
+        << name << "'" << endl;
+        std::remove(tmp_name.c_str());
+    }
+}
+
+bool Preprocessor::read_cache(const string& dir)
+{
+    std::ifstream f(cache_name(dir).c_str());
+    if (!f) {
+        return false;
+    }
+
+    const uint32_t n = in.num_vars;
+    string line, word;
+    uint64_t num_vars = 0;
+    Preprocessor p(in, sampling_set, verb);
+    p.formula.num_vars = n;
+    vector<Lit> lits;
+    bool ok = std::getline(f, line)
+        && std::istringstream(line) >> word >> word >> num_vars
+        && word == "approxmc-preprocessed" && num_vars == n;
+    while (ok && std::getline(f, line)) {
+        std::istringstream ss(line);
+        if (line.compare(0, 7, "c unit ") == 0) {
+            ss >> word >> word;
+            ok = read_lits(ss, n, p.units);
+        } else if (line.compare(0, 8, "c equiv ") == 0) {
+            uint32_t v;
+            ok = (bool)(ss >> word >> word >> v) && v >= 1 && v <= n
+                && read_lits(ss, n, lits) && lits.size() == 1;
+            if (ok) {
+                p.equivs.push_back(std::make_pair(v-1, lits[0]));
+            }
+        } else if (line.compare(0, 7, "c elim ") == 0) {
+            uint32_t v;
+            size_t num;
+            ok = (bool)(ss >> word >> word >> v >> num) && v >= 1 && v <= n;
+            vector<vector<Lit>> cls;
+            for (size_t i = 0; ok && i < num; i++) {
+                std::istringstream cs;
+                ok = (bool)std::getline(f, line) && line.compare(0, 9, "c elimcl ") == 0;
+                if (ok) {
+                    cs.str(line.substr(9));
+                    ok = read_lits(cs, n, lits);
+                    cls.push_back(lits);
+                }
+            }
+            if (ok) {
+                p.elims.push_back(std::make_pair(v-1, cls));
+            }
+        } else if (line.empty() || line[0] == 'c' || line[0] == 'p') {
+            continue;
+        } else if (line[0] == 'x') {
+            std::istringstream xs(line.substr(1));
+            ok = read_lits(xs, n, lits) && !lits.empty();
+            if (ok) {
+                std::pair<vector<uint32_t>, bool> x;
+                x.second = !lits[0].sign();
+                for (const Lit l: lits) {
+                    x.first.push_back(l.var());
+                }
+                p.formula.xors.push_back(x);
+            }
+        } else {
+            ok = read_lits(ss, n, lits);
+            p.formula.clauses.push_back(lits);
+        }
+    }
+    if (!ok) {
+        cout << "c [appmc] WARNING: ignoring malformed preprocessing cache '"
+        << cache_name(dir) << "'" << endl;
+        return false;
+    }
+
+    formula = p.formula;
+    units = p.units;
+    equivs = p.equivs;
+    elims = p.elims;
+    return true;
+}
@@ -0,0 +1,90 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef PREPROCESS_H_
+#define PREPROCESS_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "counter.h"
+
+//Reduces the formula before counting, keeping its count projected on the
+//sampling set: unit propagation, substitution of equivalent literals found
+//as strongly connected components of the binary implication graph, and
+//elimination of variables outside the sampling set by resolution when that
+//does not grow the formula. Sampling set variables are never removed, and
+//variable numbers are kept. What was removed is kept as a reconstruction
+//map, so models of the reduced formula can be extended.
+class Preprocessor {
+public:
+    Preprocessor(const InputFormula& in, const std::vector<uint32_t>& sampling_set
+        , uint32_t verbosity);
+
+    //Returns false if the formula was found UNSAT. 'formula' is then
+    //a single empty clause
+    bool run();
+
+    InputFormula formula;
+
+    //Reconstruction map, in the order things were done
+    std::vector<CMSat::Lit> units; //fixed literals of non-sampling variables
+    std::vector<std::pair<uint32_t, CMSat::Lit>> equivs; //var replaced by literal
+    std::vector<std::pair<uint32_t, std::vector<std::vector<CMSat::Lit>>>> elims;
+
+    //Variables the reduced formula does not constrain any more, though
+    //the original did
+    std::vector<uint32_t> removed_vars() const;
+
+    //Results are cached under 'dir' keyed by the formula's fingerprint
+    //and the sampling set
+    bool read_cache(const std::string& dir);
+    void write_cache(const std::string& dir) const;
+
+private:
+    bool propagate();
+    bool substitute_equivs();
+    bool eliminate();
+    bool eliminate_var(const uint32_t v);
+    void add_clause(const std::vector<CMSat::Lit>& cl);
+    void finish(bool sat);
+    std::string cache_name(const std::string& dir) const;
+
+    const InputFormula& in;
+    const std::vector<uint32_t>& sampling_set;
+    const uint32_t verb;
+    std::vector<char> in_sampling;
+    std::vector<char> in_xor;
+
+    std::vector<std::vector<CMSat::Lit>> clauses;
+    std::vector<char> deleted;
+    std::vector<std::vector<uint32_t>> occ; //clause indexes by literal
+    std::vector<std::pair<std::vector<uint32_t>, bool>> xors;
+    std::vector<CMSat::lbool> value;
+    std::vector<char> gone; //eliminated or substituted
+};
+
+#endif //PREPROCESS_H_
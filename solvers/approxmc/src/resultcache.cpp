@@ -0,0 +1,203 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+
+#include "resultcache.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "bcnf.h"
+#include "tmpname.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+using namespace CMSat;
+
+static const uint64_t fnv_basis = 14695981039346656037ULL;
+
+template<class T>
+static uint64_t hash_vec(uint64_t h, const vector<T>& v)
+{
+    const uint64_t sz = v.size();
+    h = bcnf_fnv1a(h, &sz, sizeof(sz));
+    return bcnf_fnv1a(h, v.data(), v.size()*sizeof(T));
+}
+
+//Clauses are hashed one by one, and the sorted hashes make up the key, so
+//the same clause set read in a different order gives the same key
+uint64_t ResultCache::key(const InputFormula& in, const Config& conf)
+{
+    vector<uint64_t> parts;
+    vector<uint32_t> buf;
+    for (const auto& cl: in.clauses) {
+        buf.clear();
+        for (const Lit l: cl) {
+            buf.push_back(l.toInt());
+        }
+        std::sort(buf.begin(), buf.end());
+        parts.push_back(hash_vec(fnv_basis, buf));
+    }
+    for (const auto& x: in.xors) {
+        buf = x.first;
+        std::sort(buf.begin(), buf.end());
+        buf.push_back(x.second);
+        parts.push_back(hash_vec(fnv_basis ^ 1, buf));
+    }
+    std::sort(parts.begin(), parts.end());
+
+    uint64_t h = fnv_basis;
+    h = bcnf_fnv1a(h, &in.num_vars, sizeof(in.num_vars));
+    h = hash_vec(h, parts);
+
+    buf = conf.sampling_set;
+    std::sort(buf.begin(), buf.end());
+    buf.erase(std::unique(buf.begin(), buf.end()), buf.end());
+    h = hash_vec(h, buf);
+
+    buf.clear();
+    for (const Lit l: conf.assumptions) {
+        buf.push_back(l.toInt());
+    }
+    std::sort(buf.begin(), buf.end());
+    h = hash_vec(h, buf);
+
+    //Parameters the estimate depends on. An empty sampling set is counted
+    //on an independent support or on all variables, the count is the same
+    std::ostringstream ss;
+    ss << std::setprecision(17)
+    << "eps " << conf.epsilon
+    << " delta " << conf.delta
+    << " seed " << conf.seed
+    << " sparse " << conf.sparse
+    << " start_iter " << conf.start_iter
+    << " components " << conf.components
+    << " fast_hit " << conf.fast_hit;
+    const string params = ss.str();
+    h = bcnf_fnv1a(h, params.data(), params.size());
+    return h;
+}
+
+string ResultCache::file_name(const string& dir, const uint64_t key)
+{
+    std::stringstream ss;
+    ss << dir << "/" << std::hex << std::setw(16) << std::setfill('0')
+    << key << ".count";
+    return ss.str();
+}
+
+static bool read_phase(std::istream& in, ApproxMC::PhaseTime& p)
+{
+    return (bool)(in >> p.cpu >> p.wall);
+}
+
+//The size of the formula is kept too, to catch most fingerprint collisions
+bool ResultCache::read(const string& dir, const uint64_t key
+    , const InputFormula& in, ApproxMC::SolCount& count, ApproxMC::Stats& stats)
+{
+    std::ifstream f(file_name(dir, key).c_str());
+    if (!f) {
+        return false;
+    }
+
+    string word;
+    uint64_t num_vars, num_clauses, num_xors;
+    ApproxMC::SolCount c;
+    ApproxMC::Stats st;
+    if (!(f >> word) || word != "approxmc-result"
+        || !(f >> word >> num_vars) || word != "vars"
+        || !(f >> word >> num_clauses) || word != "clauses"
+        || !(f >> word >> num_xors) || word != "xors"
+        || !(f >> word >> c.cellSolCount >> c.hashCount) || word != "count"
+        || !(f >> word) || word != "times"
+        || !read_phase(f, st.initial_check)
+        || !read_phase(f, st.simplify)
+        || !read_phase(f, st.hash_add)
+        || !read_phase(f, st.ban_add)
+        || !read_phase(f, st.sat)
+        || !read_phase(f, st.total)
+        || !(f >> word) || word != "counters"
+        || !(f >> st.sat_calls >> st.solutions >> st.repeated
+            >> st.xors_added >> st.cells >> st.compactions >> st.peak_rss)
+    ) {
+        cout << "c [appmc] WARNING: ignoring malformed result cache file '"
+        << file_name(dir, key) << "'" << endl;
+        return false;
+    }
+    if (num_vars != in.num_vars
+        || num_clauses != in.clauses.size()
+        || num_xors != in.xors.size()
+    ) {
+        return false;
+    }
+
+    c.valid = true;
+    count = c;
+    stats = st;
+    return true;
+}
+
+static void write_phase(std::ostream& out, const ApproxMC::PhaseTime& p)
+{
+    out << " " << p.cpu << " " << p.wall;
+}
+
+void ResultCache::write(const string& dir, const uint64_t key
+    , const InputFormula& in, const ApproxMC::SolCount& count
+    , const ApproxMC::Stats& stats)
+{
+    const string name = file_name(dir, key);
+    const string tmp_name = tmp_file_name(name);
+    std::ofstream f(tmp_name.c_str());
+    f << std::setprecision(17);
+    f << "approxmc-result" << endl
+    << "vars " << in.num_vars << endl
+    << "clauses " << in.clauses.size() << endl
+    << "xors " << in.xors.size() << endl
+    << "count " << count.cellSolCount << " " << count.hashCount << endl
+    << "times";
+    write_phase(f, stats.initial_check);
+    write_phase(f, stats.simplify);
+    write_phase(f, stats.hash_add);
+    write_phase(f, stats.ban_add);
+    write_phase(f, stats.sat);
+    write_phase(f, stats.total);
+    f << endl
+    << "counters " << stats.sat_calls << " " << stats.solutions
+    << " " << stats.repeated << " " << stats.xors_added
+    << " " << stats.cells << " " << stats.compactions
+    << " " << stats.peak_rss << endl;
+    f.close();
+
+    if (!f || std::rename(tmp_name.c_str(), name.c_str()) != 0) {
+        cout << "c [appmc] WARNING: could not write result cache '"
+        << name << "'" << endl;
+        std::remove(tmp_name.c_str());
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+
+#ifndef RESULTCACHE_H_
+#define RESULTCACHE_H_
+
+#include <cstdint>
+#include <string>
+#include "approxmc.h"
+#include "config.h"
+#include "counter.h"
+
+//Results of finished counts kept on disk, one file per count in a
+//directory. The file is named by a fingerprint of the formula, the
+//sampling set and assumptions, and the parameters the estimate depends on.
+//The order of clauses and of literals in them does not change it.
+class ResultCache {
+public:
+    static uint64_t key(const InputFormula& in, const Config& conf);
+    static bool read(const std::string& dir, const uint64_t key
+        , const InputFormula& in, ApproxMC::SolCount& count, ApproxMC::Stats& stats);
+    static void write(const std::string& dir, const uint64_t key
+        , const InputFormula& in, const ApproxMC::SolCount& count
+        , const ApproxMC::Stats& stats);
+
+private:
+    static std::string file_name(const std::string& dir, const uint64_t key);
+};
+
+#endif //RESULTCACHE_H_
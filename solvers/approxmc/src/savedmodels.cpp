@@ -0,0 +1,189 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "savedmodels.h"
+#include <cassert>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define APPMC_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace CMSat;
+
+const uint32_t SavedModels::slice_words;
+const uint32_t SavedModels::slice_models;
+
+void SavedModels::clear()
+{
+    num_idxs = 0;
+    words = 0;
+    arena.clear();
+    slices.clear();
+    hash_nums.clear();
+}
+
+void SavedModels::add(
+    const uint32_t hash_num,
+    const vector<lbool>& model,
+    const vector<uint32_t>& sampling_set)
+{
+    if (words == 0) {
+        num_idxs = sampling_set.size();
+        words = (num_idxs+63)/64;
+    }
+    assert(num_idxs == sampling_set.size());
+
+    const size_t start = arena.size();
+    arena.resize(start + words, 0);
+    uint64_t* at = arena.data() + start;
+    for (uint32_t i = 0; i < num_idxs; i++) {
+        assert(model[sampling_set[i]] != l_Undef);
+        if (model[sampling_set[i]] == l_True) {
+            at[i/64] |= 1ULL << (i%64);
+        }
+    }
+    hash_nums.push_back(hash_num);
+
+    if (size() % slice_models == 0) {
+        add_slices(size()/slice_models - 1);
+    }
+}
+
+//Transposes the models of a group that just filled up
+void SavedModels::add_slices(const size_t group)
+{
+    assert(slices.size() == group*num_idxs*slice_words);
+    slices.resize(slices.size() + (size_t)num_idxs*slice_words, 0);
+    uint64_t* out = slices.data() + group*num_idxs*slice_words;
+    for (uint32_t m = 0; m < slice_models; m++) {
+        const uint64_t* in = model(group*slice_models + m);
+        const uint64_t bit = 1ULL << (m%64);
+        for (uint32_t i = 0; i < num_idxs; i++) {
+            if ((in[i/64] >> (i%64)) & 1ULL) {
+                out[(size_t)i*slice_words + m/64] |= bit;
+            }
+        }
+    }
+}
+
+bool SavedModels::and_parity(const uint64_t* a, const uint64_t* b, const uint32_t num_words)
+{
+    uint64_t x = 0;
+    for (uint32_t i = 0; i < num_words; i++) {
+        x ^= a[i] & b[i];
+    }
+    #ifdef __GNUC__
+    return __builtin_parityll(x);
+    #else
+    x ^= x >> 32;
+    x ^= x >> 16;
+    x ^= x >> 8;
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return x & 1ULL;
+    #endif
+}
+
+////////////////////////////
+// Kernels for group_parity
+////////////////////////////
+
+typedef void (*xor_rows_func)(
+    const uint64_t* group, const uint32_t* idxs, size_t num, uint64_t* acc);
+
+static void xor_rows_scalar(
+    const uint64_t* group, const uint32_t* idxs, size_t num, uint64_t* acc)
+{
+    for (uint32_t k = 0; k < SavedModels::slice_words; k++) {
+        acc[k] = 0;
+    }
+    for (size_t i = 0; i < num; i++) {
+        const uint64_t* row = group + (size_t)idxs[i]*SavedModels::slice_words;
+        for (uint32_t k = 0; k < SavedModels::slice_words; k++) {
+            acc[k] ^= row[k];
+        }
+    }
+}
+
+#ifdef APPMC_X86_KERNELS
+__attribute__((target("avx2")))
+static void xor_rows_avx2(
+    const uint64_t* group, const uint32_t* idxs, size_t num, uint64_t* acc)
+{
+    __m256i a0 = _mm256_setzero_si256();
+    __m256i a1 = _mm256_setzero_si256();
+    for (size_t i = 0; i < num; i++) {
+        const uint64_t* row = group + (size_t)idxs[i]*SavedModels::slice_words;
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i*)row));
+        a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i*)(row+4)));
+    }
+    _mm256_storeu_si256((__m256i*)acc, a0);
+    _mm256_storeu_si256((__m256i*)(acc+4), a1);
+}
+
+__attribute__((target("avx512f")))
+static void xor_rows_avx512(
+    const uint64_t* group, const uint32_t* idxs, size_t num, uint64_t* acc)
+{
+    __m512i a = _mm512_setzero_si512();
+    for (size_t i = 0; i < num; i++) {
+        const uint64_t* row = group + (size_t)idxs[i]*SavedModels::slice_words;
+        a = _mm512_xor_si512(a, _mm512_loadu_si512((const void*)row));
+    }
+    _mm512_storeu_si512((void*)acc, a);
+}
+#endif
+
+static xor_rows_func pick_xor_rows()
+{
+    #ifdef APPMC_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return xor_rows_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return xor_rows_avx2;
+    }
+    #endif
+    return xor_rows_scalar;
+}
+
+void SavedModels::group_parity(
+    const size_t group,
+    const vector<uint32_t>& idxs,
+    uint64_t acc[slice_words]) const
+{
+    static const xor_rows_func xor_rows = pick_xor_rows();
+
+    assert(group < num_groups());
+    xor_rows(
+        slices.data() + group*num_idxs*slice_words
+        , idxs.data(), idxs.size(), acc);
+}
@@ -0,0 +1,122 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+ Copyright (c) 2015, Supratik Chakraborty, Daniel J. Fremont,
+ Kuldeep S. Meel, Sanjit A. Seshia, Moshe Y. Vardi
+ Copyright (c) 2014, Supratik Chakraborty, Kuldeep S. Meel, Moshe Y. Vardi
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef SAVEDMODELS_H_
+#define SAVEDMODELS_H_
+
+#include <vector>
+#include <cstdint>
+#include <cryptominisat5/solvertypesmini.h>
+
+using std::vector;
+using CMSat::lbool;
+
+//Models found during one measurement, kept so they can be reused when the
+//number of hashes changes. Only the values of the sampling set are stored,
+//packed 64 per word, one model after the other in a single arena.
+//
+//Every full group of slice_models models is also kept transposed
+//("bit-sliced"): for every sampling variable the group holds slice_words
+//words whose bits are that variable's value in each model of the group.
+//XOR-ing the rows of a hash's variables then evaluates the hash on a whole
+//group of models at once. Models past the last full group are only in the
+//arena, so small cells do not pay for a group's worth of slices.
+class SavedModels
+{
+public:
+    static const uint32_t slice_words = 8;
+    static const uint32_t slice_models = slice_words*64;
+
+    void clear();
+    void add(
+        const uint32_t hash_num,
+        const vector<lbool>& model,
+        const vector<uint32_t>& sampling_set
+    );
+
+    size_t size() const
+    {
+        return hash_nums.size();
+    }
+
+    //Number of hashes that were active when model 'at' was found
+    uint32_t hash_num(const size_t at) const
+    {
+        return hash_nums[at];
+    }
+
+    //Value of the idx-th sampling variable in model 'at'
+    bool value(const size_t at, const uint32_t idx) const
+    {
+        return (arena[at*words + idx/64] >> (idx%64)) & 1ULL;
+    }
+
+    const uint64_t* model(const size_t at) const
+    {
+        return arena.data() + at*words;
+    }
+
+    uint32_t words_per_model() const
+    {
+        return words;
+    }
+
+    //Parity of the bits set both in model 'at' and in 'row', where 'row'
+    //is a packed set of sampling-set positions
+    bool parity(const size_t at, const vector<uint64_t>& row) const
+    {
+        return and_parity(model(at), row.data(), words);
+    }
+
+    //Number of full, transposed groups
+    size_t num_groups() const
+    {
+        return size()/slice_models;
+    }
+
+    //XOR of the rows of the sampling-set positions 'idxs' in group 'group'.
+    //Bit b of acc[k] is the parity of model group*slice_models + k*64 + b.
+    void group_parity(
+        const size_t group,
+        const vector<uint32_t>& idxs,
+        uint64_t acc[slice_words]
+    ) const;
+
+    static bool and_parity(const uint64_t* a, const uint64_t* b, const uint32_t num_words);
+
+private:
+    void add_slices(const size_t group);
+
+    uint32_t num_idxs = 0;
+    uint32_t words = 0;
+    vector<uint64_t> arena;
+    vector<uint64_t> slices;
+    vector<uint32_t> hash_nums;
+};
+
+#endif //SAVEDMODELS_H_
@@ -30,6 +30,7 @@ THE SOFTWARE.
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <chrono>
 #include <signal.h>
 
 // note: MinGW64 defines both __MINGW32__ and __MINGW64__
@@ -78,6 +79,14 @@ static inline double cpuTimeTotal(void)
 
 #endif
 
+//Seconds on a monotonic clock, for deadlines. Unlike cpuTime(), it does not
+//depend on how many threads are running
+static inline double wallTime(void)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
 #if defined(__linux__)
 // process_mem_usage(double &, double &) - takes two doubles by reference,
 // attempts to read the system-dependent data for a process' virtual memory
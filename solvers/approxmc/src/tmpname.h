@@ -0,0 +1,52 @@
+/*
+ ApproxMC
+
+ Copyright (c) 2019-2020, Mate Soos and Kuldeep S. Meel. All rights reserved
+ Copyright (c) 2009-2018, Mate Soos. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#ifndef TMPNAME_H_
+#define TMPNAME_H_
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#ifdef _WIN32
+#include <process.h>
+#define appmc_getpid _getpid
+#else
+#include <unistd.h>
+#define appmc_getpid getpid
+#endif
+
+//Files are written under this name, then renamed to 'name'. Each process
+//and each write gets its own, so counters writing the same cache entry at
+//the same time never write into one file
+inline std::string tmp_file_name(const std::string& name)
+{
+    static std::atomic<uint64_t> num_written(0);
+    std::stringstream ss;
+    ss << name << "." << appmc_getpid() << "." << num_written++ << ".tmp";
+    return ss.str();
+}
+
+#endif //TMPNAME_H_
@@ -0,0 +1,395 @@
+/******************************************
+Copyright (c) 2020, Mate Soos
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+***********************************************/
+
+//Microbenchmarks of the counting internals on fixed-seed instances.
+//
+//  microbench [--json FILE] [--min-time SECONDS] [--search SEEDS] [CNF...]
+//
+//Without CNFs, a few instances from cnf/KConfig and cnf/CDL are used. The
+//JSON written with --json has the layout of Google Benchmark's, so its
+//compare.py can compare two runs.
+//
+//With --search, whole counts are run instead, with SEEDS seeds for each
+//hash search strategy, and the cells counted (bounded_sol_count calls) and
+//SAT calls they took are reported.
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "counter.h"
+#include "mmapdimacs.h"
+#include "time_mem.h"
+#include "GitSHA1.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#ifndef APPROXMC_BENCH_CNF_DIR
+#define APPROXMC_BENCH_CNF_DIR "../../../cnf"
+#endif
+
+static const char* default_instances[] = {
+    "KConfig/axTLS.dimacs",
+    "KConfig/uClibc.dimacs",
+    "CDL/aaed2000.dimacs",
+    "CDL/XSEngine.dimacs",
+    NULL
+};
+
+static const uint32_t bench_seed = 1;
+static double min_time = 0.5;
+
+struct BenchResult {
+    string name;
+    uint64_t iterations;
+    double real_ns;
+    double cpu_ns;
+    vector<std::pair<string, double>> counters; //user counters in the JSON
+};
+
+static volatile uint64_t sink;
+
+//Runs 'op' in batches of doubling size until min_time has passed or
+//max_iters ops were done. Ops that grow the solver get a small max_iters
+template<class F>
+static BenchResult run(const string& name, uint64_t max_iters, F op)
+{
+    uint64_t iters = 0;
+    uint64_t batch = 1;
+    const double start_wall = wallTime();
+    const double start_cpu = cpuTime();
+    while (true) {
+        for (uint64_t i = 0; i < batch; i++) {
+            sink = sink + op();
+        }
+        iters += batch;
+        if (iters >= max_iters || wallTime() - start_wall >= min_time) {
+            break;
+        }
+        batch = std::min<uint64_t>(batch*2, max_iters - iters);
+    }
+
+    BenchResult r;
+    r.name = name;
+    r.iterations = iters;
+    r.real_ns = (wallTime() - start_wall)*1e9/iters;
+    r.cpu_ns = (cpuTime() - start_cpu)*1e9/iters;
+    cout << std::left << std::setw(40) << r.name << std::right
+    << std::setw(14) << std::fixed << std::setprecision(0) << r.real_ns << " ns"
+    << std::setw(14) << r.cpu_ns << " ns"
+    << std::setw(10) << r.iterations << endl;
+    return r;
+}
+
+//A DIMACS file read with the counter's own parser, so "c ind" and XOR
+//lines are understood as they are when counting
+struct BenchInstance {
+    string name;
+    uint32_t num_vars = 0;
+    vector<uint32_t> sampling_set;
+    InputFormula input;
+
+    bool read(const string& filename)
+    {
+        MmapDimacsParser parser(&input, 0);
+        if (!parser.map_file(filename) || !parser.parse_mapped()) {
+            return false;
+        }
+        name = filename.substr(filename.find_last_of('/')+1);
+        name = name.substr(0, name.find('.'));
+
+        num_vars = input.num_vars;
+        sampling_set = parser.sampling_vars;
+        if (sampling_set.empty()) {
+            for (uint32_t i = 0; i < num_vars; i++) {
+                sampling_set.push_back(i);
+            }
+        }
+        return true;
+    }
+};
+
+//Sets up a Counter as Counter::solve() would, without counting
+class CounterBench {
+public:
+    explicit CounterBench(const BenchInstance& inst)
+    {
+        c.conf.seed = bench_seed;
+        c.conf.sampling_set = inst.sampling_set;
+        c.orig_num_vars = inst.num_vars;
+        c.input = inst.input;
+        c.solver = c.new_solver_from_input(c.input);
+        c.startTime = cpuTimeTotal();
+        c.startWallTime = wallTime();
+        c.randomEngine.seed(bench_seed);
+        uint32_t measurements;
+        c.set_up_probs_threshold_measurements(measurements, sparse_data);
+    }
+
+    ~CounterBench()
+    {
+        delete c.solver;
+    }
+
+    //Benchmarks of one instance, appended to 'results'
+    static void bench_instance(const BenchInstance& inst, vector<BenchResult>& results);
+    static void search_instance(const BenchInstance& inst, uint32_t seeds
+        , vector<BenchResult>& results);
+
+    Counter c;
+    SparseData sparse_data{-1};
+};
+
+void CounterBench::bench_instance(const BenchInstance& inst, vector<BenchResult>& results)
+{
+    const string suffix = "/" + inst.name;
+    const uint32_t num_hashes = 8;
+
+    {
+        CounterBench b(inst);
+        const uint32_t n = b.c.conf.sampling_set.size();
+        results.push_back(run("gen_rnd_bits" + suffix, 10000000, [&]() {
+            return (uint64_t)b.c.gen_rnd_bits(n, 0, b.sparse_data).size();
+        }));
+    }
+
+    {
+        CounterBench b(inst);
+        uint32_t at = 0;
+        results.push_back(run("add_hash" + suffix, 20000, [&]() {
+            return (uint64_t)b.c.add_hash(at++, b.sparse_data).hash_vars.size();
+        }));
+    }
+
+    {
+        CounterBench b(inst);
+        if (b.c.solver->solve() != l_True) {
+            cerr << "Instance " << inst.name << " is UNSAT, skipping it" << endl;
+            return;
+        }
+        const vector<lbool> model = b.c.solver->get_model();
+        vector<Hash> hashes;
+        b.c.set_num_hashes(num_hashes, hashes, b.sparse_data);
+        results.push_back(run("check_model_against_hash" + suffix, 100000000, [&]() {
+            uint64_t ok = 0;
+            for (const Hash& h: hashes) {
+                ok += b.c.check_model_against_hash(h, model);
+            }
+            return ok;
+        }));
+    }
+
+    {
+        //Random models, as many as a few measurements would save
+        CounterBench b(inst);
+        HashesModels hm;
+        b.c.set_num_hashes(num_hashes, hm.hashes, b.sparse_data);
+        std::mt19937_64 rnd(bench_seed);
+        vector<lbool> model(b.c.solver->nVars(), l_False);
+        for (uint32_t i = 0; i < 4*b.c.threshold; i++) {
+            for (const uint32_t var: b.c.conf.sampling_set) {
+                model[var] = (rnd() & 1) ? l_True : l_False;
+            }
+            hm.glob_model.add(rnd() % (num_hashes+1), model, b.c.conf.sampling_set);
+        }
+        b.c.solver->new_var();
+        const uint32_t act_var = b.c.solver->nVars()-1;
+        results.push_back(run("add_glob_banning_cls" + suffix, 2000, [&]() {
+            return b.c.add_glob_banning_cls(&hm, act_var, num_hashes/2);
+        }));
+    }
+
+    {
+        //One step of the galloping search with a single hash
+        CounterBench b(inst);
+        HashesModels hm;
+        const vector<Lit> assumps = b.c.set_num_hashes(1, hm.hashes, b.sparse_data);
+        results.push_back(run("bounded_sol_count" + suffix, 50, [&]() {
+            hm.glob_model.clear();
+            return b.c.bounded_sol_count(
+                b.c.threshold+1, &assumps, 1, 0, &hm).solutions;
+        }));
+    }
+}
+
+//Whole counts with the midpoint and the log-guided ("fast hit") search.
+//Components are not split off, so every count goes through the search
+void CounterBench::search_instance(const BenchInstance& inst, uint32_t seeds
+    , vector<BenchResult>& results)
+{
+    for (int fast_hit = 0; fast_hit < 2; fast_hit++) {
+        ApproxMC::Stats st;
+        uint64_t measurements = 0;
+        vector<string> counts;
+        const double start_wall = wallTime();
+        const double start_cpu = cpuTime();
+        for (uint32_t seed = 1; seed <= seeds; seed++) {
+            CounterBench b(inst);
+            Config conf = b.c.conf;
+            conf.seed = seed;
+            conf.fast_hit = fast_hit;
+            conf.components = 0;
+            const ApproxMC::SolCount cnt = b.c.solve(conf);
+            measurements += b.c.numHashList.size();
+            std::stringstream ss;
+            ss << cnt.cellSolCount << "*2**" << cnt.hashCount;
+            counts.push_back(ss.str());
+
+            const ApproxMC::Stats s = b.c.get_stats();
+            st.cells += s.cells;
+            st.sat_calls += s.sat_calls;
+        }
+
+        BenchResult r;
+        r.name = string(fast_hit ? "search_fasthit/" : "search_midpoint/") + inst.name;
+        r.iterations = seeds;
+        r.real_ns = (wallTime() - start_wall)*1e9/seeds;
+        r.cpu_ns = (cpuTime() - start_cpu)*1e9/seeds;
+        const double per_meas = std::max<uint64_t>(measurements, 1);
+        r.counters.push_back(std::make_pair("cells_per_measurement", st.cells/per_meas));
+        r.counters.push_back(std::make_pair("sat_calls_per_measurement", st.sat_calls/per_meas));
+        r.counters.push_back(std::make_pair("sat_calls", (double)st.sat_calls/seeds));
+        cout << std::left << std::setw(40) << r.name << std::right
+        << std::setw(14) << std::fixed << std::setprecision(2)
+        << r.counters[0].second << " cells"
+        << std::setw(10) << r.counters[1].second << " SAT"
+        << "  counts:";
+        for (const string& c: counts) {
+            cout << " " << c;
+        }
+        cout << endl;
+        results.push_back(r);
+    }
+}
+
+static string json_escape(const string& s)
+{
+    string ret;
+    for (const char c: s) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+        }
+        ret += c;
+    }
+    return ret;
+}
+
+static bool write_json(const string& filename, const vector<BenchResult>& results)
+{
+    std::ofstream out(filename.c_str());
+    if (!out) {
+        return false;
+    }
+
+    char date[64];
+    const time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    out << "{" << endl
+    << "  \"context\": {" << endl
+    << "    \"date\": \"" << date << "\"," << endl
+    << "    \"num_cpus\": " << std::thread::hardware_concurrency() << "," << endl
+    << "    \"approxmc_version\": \"" << json_escape(get_version_sha1()) << "\"," << endl
+    << "    \"seed\": " << bench_seed << endl
+    << "  }," << endl
+    << "  \"benchmarks\": [" << endl;
+    out << std::setprecision(17);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {"
+        << "\"name\": \"" << json_escape(r.name) << "\", "
+        << "\"run_name\": \"" << json_escape(r.name) << "\", "
+        << "\"run_type\": \"iteration\", "
+        << "\"iterations\": " << r.iterations << ", "
+        << "\"real_time\": " << r.real_ns << ", "
+        << "\"cpu_time\": " << r.cpu_ns << ", ";
+        for (const auto& c: r.counters) {
+            out << "\"" << json_escape(c.first) << "\": " << c.second << ", ";
+        }
+        out << "\"time_unit\": \"ns\"}"
+        << (i+1 < results.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl << "}" << endl;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    string json_file;
+    uint32_t search_seeds = 0;
+    vector<string> files;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+            json_file = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i+1 < argc) {
+            min_time = std::atof(argv[++i]);
+        } else if (strcmp(argv[i], "--search") == 0 && i+1 < argc) {
+            search_seeds = std::atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            cerr << "Usage: " << argv[0]
+            << " [--json FILE] [--min-time SECONDS] [--search SEEDS] [CNF...]" << endl;
+            return 1;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        for (const char** f = default_instances; *f != NULL; f++) {
+            files.push_back(string(APPROXMC_BENCH_CNF_DIR) + "/" + *f);
+        }
+    }
+
+    if (search_seeds == 0) {
+        cout << std::left << std::setw(40) << "Benchmark" << std::right
+        << std::setw(17) << "Time" << std::setw(17) << "CPU"
+        << std::setw(10) << "Iters" << endl;
+    }
+    vector<BenchResult> results;
+    for (const string& f: files) {
+        BenchInstance inst;
+        if (!inst.read(f)) {
+            cerr << "ERROR: cannot read CNF '" << f << "'" << endl;
+            return 1;
+        }
+        if (search_seeds > 0) {
+            CounterBench::search_instance(inst, search_seeds, results);
+        } else {
+            CounterBench::bench_instance(inst, results);
+        }
+    }
+
+    if (!json_file.empty() && !write_json(json_file, results)) {
+        cerr << "ERROR: cannot write '" << json_file << "'" << endl;
+        return 1;
+    }
+    return 0;
+}
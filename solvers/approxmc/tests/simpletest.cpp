@@ -27,6 +27,11 @@ THE SOFTWARE.
 #include <string>
 #include <vector>
 #include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <dirent.h>
+#include <unistd.h>
 using std::string;
 using std::vector;
 
@@ -62,6 +67,84 @@ TEST(normal_interface, example2)
     EXPECT_EQ(std::pow(2, 10), x);
 }
 
+TEST(normal_interface, example2_fast_hit)
+{
+    AppMC s;
+    s.new_vars(10);
+    s.set_fast_hit(1);
+    SolCount c = s.count();
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 10), x);
+}
+
+TEST(normal_interface, example2_enum_engine)
+{
+    AppMC s;
+    s.new_vars(6);
+    s.set_enum_engine(1);
+    s.add_clause(str_to_cl("1, 2, 3"));
+    s.add_clause(str_to_cl("-4, 5"));
+    SolCount c = s.count();
+    EXPECT_EQ(0U, c.hashCount);
+    EXPECT_EQ(7U*3U*2U, c.cellSolCount);
+
+    s.set_projection_set(vector<uint32_t>{0, 1, 2, 3});
+    c = s.count();
+    EXPECT_EQ(0U, c.hashCount);
+    EXPECT_EQ(7U*2U, c.cellSolCount);
+}
+
+TEST(normal_interface, example2_preprocess)
+{
+    AppMC s;
+    s.new_vars(5);
+    s.set_preprocess(1);
+    //5 = 1 AND 2, only there to encode (1 AND 2) OR 3
+    s.add_clause(str_to_cl("-5, 1"));
+    s.add_clause(str_to_cl("-5, 2"));
+    s.add_clause(str_to_cl("5, -1, -2"));
+    s.add_clause(str_to_cl("5, 3"));
+    s.set_projection_set(vector<uint32_t>{0, 1, 2, 3});
+    SolCount c = s.count();
+    EXPECT_EQ(0U, c.hashCount);
+    EXPECT_EQ(10U, c.cellSolCount);
+
+    s.add_clause(str_to_cl("-4"));
+    c = s.count();
+    EXPECT_EQ(0U, c.hashCount);
+    EXPECT_EQ(5U, c.cellSolCount);
+}
+
+TEST(normal_interface, example2_cubes)
+{
+    AppMC s;
+    s.new_vars(10);
+    s.set_cube_threads(3, 2);
+    s.add_clause(str_to_cl("1, 2, 3"));
+    s.add_clause(str_to_cl("-4, 5"));
+    s.set_projection_set(vector<uint32_t>{0, 1, 2, 3, 4, 5});
+    SolCount c = s.count();
+    EXPECT_EQ(0U, c.hashCount);
+    EXPECT_EQ(7U*3U*2U, c.cellSolCount);
+
+    s.set_projection_set(vector<uint32_t>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+    c = s.count();
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_GT(x, 7U*3U*32U/2U);
+    EXPECT_GT(7U*3U*32U*2U, x);
+}
+
+TEST(normal_interface, example2_compact)
+{
+    AppMC s;
+    s.new_vars(10);
+    s.set_compact(1);
+    SolCount c = s.count();
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 10), x);
+    EXPECT_GT(s.get_stats().compactions, 0U);
+}
+
 TEST(normal_interface, example3)
 {
     AppMC s;
@@ -83,6 +166,236 @@ TEST(normal_interface, example4)
     EXPECT_EQ(std::pow(2, 9), cnt);
 }
 
+TEST(normal_interface, example2_threads)
+{
+    AppMC s;
+    s.set_num_threads(4);
+    s.new_vars(10);
+    SolCount c = s.count();
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 10), x);
+}
+
+TEST(normal_interface, example4_threads)
+{
+    AppMC s;
+    s.set_num_threads(3);
+    s.new_vars(10);
+    s.add_clause(str_to_cl("-3, 4"));
+    s.add_clause(str_to_cl("3, -4"));
+    SolCount c = s.count();
+    uint32_t cnt = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 9), cnt);
+}
+
+TEST(normal_interface, example4_ind_support)
+{
+    AppMC s;
+    s.set_ind_support(1);
+    s.new_vars(10);
+    s.add_clause(str_to_cl("-3, 4"));
+    s.add_clause(str_to_cl("3, -4"));
+    SolCount c = s.count();
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 9), x);
+    EXPECT_EQ(9U, s.get_sampling_set().size());
+}
+
+TEST(normal_interface, example4_components)
+{
+    AppMC s;
+    s.set_components(1);
+    s.new_vars(10);
+    s.add_clause(str_to_cl("1, 2"));
+    s.add_clause(str_to_cl("3, 4"));
+    s.add_clause(str_to_cl("5"));
+    SolCount c = s.count();
+    EXPECT_EQ(0U, c.hashCount);
+    EXPECT_EQ(3U*3U*std::pow(2, 5), c.cellSolCount);
+}
+
+//Two components with more than 128 solutions are counted approximately,
+//each on its own thread, next to one counted exactly and 2 free variables
+TEST(normal_interface, example4_components_approx)
+{
+    AppMC s;
+    s.set_components(1);
+    s.set_num_threads(2);
+    s.new_vars(20);
+    s.add_clause(str_to_cl("1, 2, 3, 4, 5, 6, 7, 8"));
+    s.add_clause(str_to_cl("9, 10, 11, 12, 13, 14, 15, 16"));
+    s.add_clause(str_to_cl("17, 18"));
+    SolCount c = s.count();
+    EXPECT_TRUE(c.valid);
+    EXPECT_GT(s.get_stats().xors_added, 0U);
+    const double exact = 255.0*255.0*3*4;
+    const double x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_GE(x, exact/1.8);
+    EXPECT_LE(x, exact*1.8);
+}
+
+TEST(normal_interface, example3_assumptions)
+{
+    AppMC s;
+    s.new_vars(10);
+    s.add_clause(str_to_cl("-3, 4"));
+    s.add_clause(str_to_cl("3, -4"));
+
+    SolCount c = s.count(str_to_cl("1"));
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 8), x);
+
+    c = s.count(str_to_cl("3, -4"));
+    EXPECT_TRUE(c.valid);
+    EXPECT_EQ(0U, c.cellSolCount);
+
+    c = s.count();
+    x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 9), x);
+    EXPECT_EQ(10U, s.nVars());
+}
+
+TEST(normal_interface, example3_marginals)
+{
+    AppMC s;
+    s.new_vars(10);
+    s.set_num_threads(2);
+    s.add_clause(str_to_cl("-3, 4"));
+    s.add_clause(str_to_cl("3, -4"));
+
+    vector<SolCount> c = s.count_marginals(str_to_cl("1, -3, 4"));
+    ASSERT_EQ(3U, c.size());
+    for (const SolCount& m: c) {
+        uint32_t x = std::pow(2, m.hashCount)*m.cellSolCount;
+        EXPECT_EQ(std::pow(2, 8), x);
+    }
+}
+
+TEST(normal_interface, example2_stats)
+{
+    AppMC s;
+    s.new_vars(10);
+    SolCount c = s.count();
+    EXPECT_TRUE(c.valid);
+    Stats st = s.get_stats();
+    EXPECT_GT(st.sat_calls, 0U);
+    EXPECT_GT(st.solutions, 0U);
+    EXPECT_GT(st.xors_added, 0U);
+    EXPECT_GT(st.peak_rss, 0U);
+    EXPECT_GE(st.total.wall, st.sat.wall);
+
+    s.count();
+    EXPECT_GT(s.get_stats().sat_calls, st.sat_calls);
+}
+
+//Removes a directory made by mkdtemp() and the files in it
+static void remove_dir(const char* dir)
+{
+    DIR* d = opendir(dir);
+    if (d != NULL) {
+        while (const dirent* e = readdir(d)) {
+            if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) {
+                unlink((string(dir) + "/" + e->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+TEST(normal_interface, example4_result_cache)
+{
+    char dir[] = "/tmp/appmc_cacheXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+
+    SolCount c[2];
+    for (int i = 0; i < 2; i++) {
+        AppMC s;
+        s.set_result_cache(dir);
+        s.new_vars(10);
+        s.add_clause(str_to_cl(i == 0 ? "1, 2" : "2, 1"));
+        c[i] = s.count();
+        EXPECT_EQ((uint64_t)i, s.get_stats().cache_hits);
+    }
+    EXPECT_TRUE(c[1].valid);
+    EXPECT_EQ(c[0].cellSolCount, c[1].cellSolCount);
+    EXPECT_EQ(c[0].hashCount, c[1].hashCount);
+    remove_dir(dir);
+}
+
+TEST(normal_interface, example2_progress)
+{
+    AppMC s;
+    s.new_vars(10);
+    vector<Progress> reports;
+    SolCount c = s.count(0, [&](const Progress& p) { reports.push_back(p); });
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 10), x);
+    EXPECT_FALSE(reports.empty());
+    for (size_t i = 0; i < reports.size(); i++) {
+        EXPECT_EQ(i+1, reports[i].measurements_done);
+        EXPECT_TRUE(reports[i].estimate.valid);
+    }
+    EXPECT_EQ(reports.back().measurements_total, reports.back().measurements_done);
+}
+
+TEST(normal_interface, example2_errors)
+{
+    AppMC s;
+    s.new_vars(10);
+    s.set_epsilon(-1);
+    EXPECT_THROW(s.count(), AppMCError);
+
+    s.set_epsilon(0.8);
+    SolCount c = s.count();
+    uint32_t x = std::pow(2, c.hashCount)*c.cellSolCount;
+    EXPECT_EQ(std::pow(2, 10), x);
+    EXPECT_THROW(s.count(str_to_cl("11")), AppMCError);
+    EXPECT_THROW(s.new_var(), AppMCError);
+}
+
+//Independent counters on many threads at once, with every kind of worker
+//thread inside them, eight of them writing each result cache entry
+TEST(normal_interface, example4_concurrent)
+{
+    char dir[] = "/tmp/appmc_cacheXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+
+    const size_t num = 32;
+    vector<SolCount> counts(num);
+    vector<SolCount> assumed(num);
+    vector<std::thread> threads;
+    for (size_t i = 0; i < num; i++) {
+        threads.push_back(std::thread([&, i]() {
+            AppMC s;
+            s.set_seed(i % 4 + 1);
+            s.set_result_cache(dir);
+            s.new_vars(10);
+            s.add_clause(str_to_cl("1, 2, 3"));
+            s.add_clause(str_to_cl("-4, 5"));
+            s.set_projection_set(vector<uint32_t>{0, 1, 2, 3, 4, 5});
+            switch (i % 4) {
+                case 0: s.set_components(1); break;
+                case 1: s.set_num_threads(2); break;
+                case 2: s.set_fast_hit(1); break;
+                case 3: s.set_preprocess(1); break;
+            }
+            counts[i] = s.count();
+            assumed[i] = s.count(str_to_cl("-1, -2"));
+        }));
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        EXPECT_EQ(0U, counts[i].hashCount);
+        EXPECT_EQ(7U*3U*2U, counts[i].cellSolCount);
+        EXPECT_EQ(0U, assumed[i].hashCount);
+        EXPECT_EQ(3U*2U, assumed[i].cellSolCount);
+    }
+    remove_dir(dir);
+}
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);